@@ -0,0 +1,120 @@
+#!/bin/bash
+#
+# bench.sh: measure goofy's own throughput over loopback against
+# goofy-target, so changes to goofy can be compared run to run without a
+# real server's limits in the way. Each scenario runs goofy for DURATION
+# seconds at a rate above what it can reach and reports the connections
+# and requests it completed per second, the CPU goofy spent per request
+# and how many periods it reported falling behind in.
+#
+# Usage: ./bench.sh [scenario...]
+#
+# Scenarios are conn (one HTTP/1.0 request per connection), keepalive
+# (HTTP/1.1, 100 requests per connection), pipeline (the same, 16 at a
+# time) and delay (one request per connection, answered after 10 ms);
+# the default is all of them. These environment variables change the
+# setup:
+#
+#   DURATION  seconds per scenario; default 10
+#   PORT      port for goofy-target; default 18080
+#   THREADS   goofy-target threads; default 2
+#   JOBS      goofy reactor threads (-j); default 1
+#   ENGINE    goofy event engine (-e); default epoll
+#   SIZE      response body bytes; default 100
+#   SOURCES   local addresses to connect from; default 16, 127.0.0.2
+#             and up
+#   GOOFY_ARGS  more arguments for goofy
+#
+# Each closed connection holds its port in TIME_WAIT for a minute, so
+# one local address cannot sustain more than a few hundred connections
+# a second; goofy rotates over SOURCES (-s) to get past that.
+#
+# goofy-target speaks only HTTP/1.x, so -2 is not benchmarked here.
+
+DURATION=${DURATION:-10}
+PORT=${PORT:-18080}
+THREADS=${THREADS:-2}
+JOBS=${JOBS:-1}
+ENGINE=${ENGINE:-epoll}
+SIZE=${SIZE:-100}
+SOURCES=${SOURCES:-$(seq -s, -f '127.0.0.%g' 2 17)}
+
+dir=$(cd "$(dirname "$0")" && pwd)
+goofy="$dir/goofy"
+target="$dir/goofy-target"
+for bin in "$goofy" "$target"; do
+    if [ ! -x "$bin" ]; then
+	echo "$bin not found; run make" >&2
+	exit 1
+    fi
+done
+
+tmp=$(mktemp -d)
+target_pid=
+trap '[ -n "$target_pid" ] && kill $target_pid 2>/dev/null; rm -rf "$tmp"' EXIT
+
+# Start goofy-target with args, replacing any already running.
+start_target() {
+    [ -n "$target_pid" ] && kill $target_pid 2>/dev/null && wait $target_pid 2>/dev/null
+    "$target" -a 127.0.0.1 -p "$PORT" -j "$THREADS" -s "$SIZE" "$@" &
+    target_pid=$!
+    sleep 0.2
+    if ! kill -0 $target_pid 2>/dev/null; then
+	echo "goofy-target failed to start" >&2
+	exit 1
+    fi
+}
+
+# Run goofy with args and print the scenario's line.
+run() {
+    local name=$1
+    shift
+    local csv="$tmp/$name.csv"
+    local TIMEFORMAT='%U %S'
+    local cpu
+    cpu=$( { time "$goofy" -e "$ENGINE" -j "$JOBS" -r 1000 -m "$DURATION" \
+	-s "$SOURCES" -o csv:"$csv" $GOOFY_ARGS "$@" http://127.0.0.1:$PORT/ >/dev/null 2>&1; } 2>&1 )
+    # Sum the connections closed and requests answered over every
+    # period, then divide by the time the last period ended. Count the
+    # periods goofy itself fell behind in, the last column.
+    awk -F, -v name="$name" -v cpu="$cpu" '
+	NR == 1 { next }
+	{ secs = $1; conns += $4; reqs += $5; behind += $NF }
+	END {
+	    split(cpu, t, " ")
+	    if (secs == 0 || reqs == 0) {
+		printf "%-10s no requests completed\n", name
+		exit
+	    }
+	    printf "%-10s %10.0f %10.0f %10.2f %10.2f %6d\n", name, conns / secs,
+		reqs / secs, (t[1] + t[2]) * 1e6 / reqs, (t[1] + t[2]) / secs * 100, behind
+	}' "$csv"
+}
+
+scenarios=${*:-conn keepalive pipeline delay}
+
+printf "%-10s %10s %10s %10s %10s %6s\n" scenario conn/s req/s "cpu us/req" "cpu %" behind
+for s in $scenarios; do
+    case $s in
+    conn)
+	start_target
+	run conn -n 50 -t 5
+	;;
+    keepalive)
+	start_target
+	run keepalive -n 10 -t 10 -k 100
+	;;
+    pipeline)
+	start_target
+	run pipeline -n 10 -t 10 -k 100:16
+	;;
+    delay)
+	start_target -d 10
+	run delay -n 50 -t 5
+	;;
+    *)
+	echo "unknown scenario: $s" >&2
+	exit 1
+	;;
+    esac
+done
@@ -0,0 +1,235 @@
+#include "corpus.hh"
+#include "request.hh"
+#include <ctype.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+request_corpus *corpus;
+
+/*
+ * Map the whole of path read-only. Return NULL for an empty file.
+ */
+static const char *map_file(const char *path, size_t *len) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+	perror(path);
+	exit(1);
+    }
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+	perror(path);
+	exit(1);
+    }
+    *len = st.st_size;
+    if (*len == 0) {
+	close(fd);
+	return NULL;
+    }
+    void *p = mmap(NULL, *len, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (p == MAP_FAILED) {
+	perror(path);
+	exit(1);
+    }
+    close(fd);
+    return (const char *) p;
+}
+
+request_corpus::request_corpus(const char *_path) : path(_path) {
+    size_t len;
+    const char *p = map_file(path, &len);
+    const char *end = p + len;
+    int lineno = 0;
+
+    while (p != NULL && p < end) {
+	const char *nl = (const char *) memchr(p, '\n', end - p);
+	if (nl == NULL)
+	    nl = end;
+	parse_line(p, nl, ++lineno);
+	p = nl + 1;
+    }
+    if (entries.empty()) {
+	fprintf(stderr, "%s: no requests\n", path);
+	exit(1);
+    }
+    // The arena is done growing; point the rewritten entries into it.
+    for (size_t i = 0; i < entries.size(); i++) {
+	if (arena_line[i].first >= 0)
+	    entries[i].line = arena.data() + arena_line[i].first;
+	if (arena_extra[i].first >= 0)
+	    entries[i].extra = arena.data() + arena_extra[i].first;
+    }
+    arena_line.clear();
+    arena_extra.clear();
+    build_alias();
+    weights.clear();
+}
+
+/*
+ * "weight METHOD /path [<body] [| Header: value]...", between p and
+ * end. Blank lines and those starting with # are skipped.
+ */
+void request_corpus::parse_line(const char *p, const char *end, int lineno) {
+    while (p < end && isspace(*p))
+	p++;
+    while (end > p && isspace(end[-1]))
+	end--;
+    if (p == end || *p == '#')
+	return;
+
+    // strtod() needs a terminated string.
+    char number[32];
+    int n = 0;
+    while (p < end && !isspace(*p) && n < (int) sizeof(number) - 1)
+	number[n++] = *p++;
+    number[n] = 0;
+    char *stop;
+    double weight = strtod(number, &stop);
+    if (*stop != 0 || !(weight > 0))
+	goto bad;
+
+    {
+	while (p < end && isspace(*p))
+	    p++;
+	const char *method = p;
+	while (p < end && !isspace(*p))
+	    p++;
+	const char *method_end = p;
+	while (p < end && isspace(*p))
+	    p++;
+	const char *uri = p;
+	while (p < end && !isspace(*p))
+	    p++;
+	const char *uri_end = p;
+	if (method == method_end || uri == uri_end)
+	    goto bad;
+
+	corpus_entry e;
+	memset(&e, 0, sizeof(e));
+	e.head = (method_end - method == 4 && memcmp(method, "HEAD", 4) == 0);
+	std::pair<long, long> line(-1, 0), extra(-1, 0);
+	if (uri - method_end == 1 && *method_end == ' ') {
+	    e.line = method;
+	    e.line_len = uri_end - method;
+	}
+	else {
+	    // Odd spacing; keep a tidy copy.
+	    line.first = arena.size();
+	    arena.append(method, method_end - method);
+	    arena += ' ';
+	    arena.append(uri, uri_end - uri);
+	    e.line_len = arena.size() - line.first;
+	}
+
+	// The body file, then headers separated by |.
+	std::string headers;
+	while (p < end && isspace(*p))
+	    p++;
+	if (p < end && *p == '<') {
+	    const char *name = ++p;
+	    while (p < end && !isspace(*p) && *p != '|')
+		p++;
+	    if (p == name)
+		goto bad;
+	    e.body = find_body(std::string(name, p - name));
+	    while (p < end && isspace(*p))
+		p++;
+	}
+	while (p < end) {
+	    if (*p++ != '|')
+		goto bad;
+	    while (p < end && isspace(*p))
+		p++;
+	    const char *h = p;
+	    while (p < end && *p != '|')
+		p++;
+	    const char *h_end = p;
+	    while (h_end > h && isspace(h_end[-1]))
+		h_end--;
+	    if (h_end == h || memchr(h, ':', h_end - h) == NULL)
+		goto bad;
+	    headers.append(h, h_end - h);
+	    headers += "\r\n";
+	}
+	if (!headers.empty()) {
+	    extra.first = arena.size();
+	    arena += headers;
+	    e.extra_len = headers.size();
+	}
+
+	entries.push_back(e);
+	weights.push_back(weight);
+	arena_line.push_back(line);
+	arena_extra.push_back(extra);
+	return;
+    }
+
+  bad:
+    fprintf(stderr, "%s:%d: expected \"weight METHOD /path [<body] [| Header: value]...\"\n",
+	    path, lineno);
+    exit(1);
+}
+
+/*
+ * Open a body file the first time an entry names it.
+ */
+const request_body *request_corpus::find_body(const std::string &name) {
+    std::map<std::string, const request_body *>::iterator it = bodies.find(name);
+    if (it == bodies.end()) {
+	// Relative names are relative to the corpus.
+	std::string file = name;
+	const char *slash = strrchr(path, '/');
+	if (name[0] != '/' && slash != NULL)
+	    file = std::string(path, slash + 1 - path) + name;
+	it = bodies.insert(std::make_pair(name, open_body(file.c_str()))).first;
+    }
+    return it->second;
+}
+
+/*
+ * Vose's version of Walker's alias method: scale the weights to
+ * average 1, then repeatedly top up an under-full cell from an
+ * over-full one, which becomes its alias.
+ */
+void request_corpus::build_alias() {
+    size_t n = weights.size();
+    double sum = 0;
+    for (size_t i = 0; i < n; i++)
+	sum += weights[i];
+
+    std::vector<double> scaled(n);
+    std::vector<int> small, large;
+    for (size_t i = 0; i < n; i++) {
+	scaled[i] = weights[i] * n / sum;
+	if (scaled[i] < 1)
+	    small.push_back(i);
+	else
+	    large.push_back(i);
+    }
+
+    cells.resize(n);
+    while (!small.empty() && !large.empty()) {
+	int s = small.back(), l = large.back();
+	small.pop_back();
+	cells[s].threshold = (uint32_t) (scaled[s] * 4294967296.0);
+	cells[s].alias = l;
+	scaled[l] -= 1 - scaled[s];
+	if (scaled[l] < 1) {
+	    large.pop_back();
+	    small.push_back(l);
+	}
+    }
+    // What is left is full, give or take rounding.
+    for (size_t i = 0; i < small.size(); i++) {
+	cells[small[i]].threshold = 0;
+	cells[small[i]].alias = small[i];
+    }
+    for (size_t i = 0; i < large.size(); i++) {
+	cells[large[i]].threshold = 0;
+	cells[large[i]].alias = large[i];
+    }
+}
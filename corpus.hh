@@ -0,0 +1,72 @@
+#ifndef CORPUS_HH_
+#define CORPUS_HH_
+/*
+ * A request corpus (-C): many weighted requests, one per line, sent in
+ * place of the URLs' own paths to defeat server caches. The file is
+ * mapped and indexed once at startup; entries point into the mapping,
+ * and each request is picked in constant time with Walker's alias
+ * method, so sending one allocates and copies nothing.
+ */
+#include <stdint.h>
+#include <map>
+#include <string>
+#include <vector>
+
+struct request_body;
+
+struct corpus_entry {
+    // "METHOD /path", usually straight from the file.
+    const char *line;
+    int line_len;
+    // Header lines, each ending in CRLF, or none.
+    const char *extra;
+    int extra_len;
+    // The request body, or NULL.
+    const request_body *body;
+    // A HEAD request, whose response has no body.
+    bool head;
+};
+
+class request_corpus {
+public:
+    // Map and index the corpus in path. Exit if it cannot be read or
+    // makes no sense.
+    request_corpus(const char *path);
+
+    size_t size() const { return entries.size(); }
+    const corpus_entry &entry(int i) const { return entries[i]; }
+
+    // Return the entry chosen by 64 random bits, in proportion to its
+    // weight.
+    int pick(uint64_t random) const {
+	int i = (int) (((random >> 32) * cells.size()) >> 32);
+	return (uint32_t) random < cells[i].threshold ? i : cells[i].alias;
+    }
+
+private:
+    void parse_line(const char *p, const char *end, int lineno);
+    void build_alias();
+    const request_body *find_body(const std::string &name);
+
+    const char *path;
+    std::vector<corpus_entry> entries;
+    std::vector<double> weights;
+    // Rewritten request lines and headers; entries point here once the
+    // whole corpus is read and it stops growing.
+    std::string arena;
+    std::vector<std::pair<long, long> > arena_line, arena_extra;
+    // Body files, each opened once.
+    std::map<std::string, const request_body *> bodies;
+
+    // Alias table: cell i is entry i with chance threshold / 2^32, and
+    // otherwise entry alias.
+    struct cell {
+	uint32_t threshold;
+	int alias;
+    };
+    std::vector<cell> cells;
+};
+
+extern request_corpus *corpus;
+
+#endif /* CORPUS_HH_ */
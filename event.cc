@@ -0,0 +1,233 @@
+#include "event.hh"
+#include "uring.hh"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+event_engine *event_engine::create(const char *name, int max_slots) {
+    if (strcmp(name, "uring") == 0) {
+	event_engine *engine = uring_engine::create(max_slots);
+	if (engine != NULL)
+	    return engine;
+	fprintf(stderr, "io_uring unavailable, using epoll\n");
+	name = "epoll";
+    }
+    if (strcmp(name, "epoll") == 0) {
+	event_engine *engine = epoll_engine::create(max_slots);
+	if (engine != NULL)
+	    return engine;
+	fprintf(stderr, "epoll unavailable, using poll\n");
+	return new poll_engine(max_slots);
+    }
+    if (strcmp(name, "poll") == 0)
+	return new poll_engine(max_slots);
+    return NULL;
+}
+
+/* Create the eventfd behind wake(). */
+static int wake_fd() {
+    int fd = eventfd(0, EFD_NONBLOCK|EFD_CLOEXEC);
+    if (fd < 0) {
+	perror("eventfd");
+	exit(1);
+    }
+    return fd;
+}
+
+/* Reset the eventfd behind wake(). */
+static void drain_wake_fd(int fd) {
+    eventfd_t val;
+    eventfd_read(fd, &val);
+}
+
+/*
+ * poll_engine
+ */
+
+poll_engine::poll_engine(int max_slots) : fds_len(max_slots), high(0), next(0) {
+    fds = (struct pollfd *)calloc(fds_len + 1, sizeof(struct pollfd));
+    for (int i = 0; i <= fds_len; i++)
+	fds[i].fd = -1;
+    fds[0].fd = wake_fd();
+    fds[0].events = POLLIN;
+}
+
+poll_engine::~poll_engine() {
+    close(fds[0].fd);
+    free(fds);
+}
+
+void poll_engine::add(int slot, int fd, int events) {
+    struct pollfd *pfd = &fds[slot+1];
+    pfd->fd = fd;
+    pfd->events = events;
+    pfd->revents = 0;
+    if (slot >= high)
+	high = slot + 1;
+}
+
+void poll_engine::modify(int slot, int fd, int events) {
+    fds[slot+1].events = events;
+}
+
+void poll_engine::remove(int slot, int fd) {
+    // poll() ignores negative fds.
+    struct pollfd *pfd = &fds[slot+1];
+    pfd->fd = -1;
+    pfd->events = pfd->revents = 0;
+    while (high > 0 && fds[high].fd < 0)
+	high--;
+}
+
+void poll_engine::wake() {
+    eventfd_write(fds[0].fd, 1);
+}
+
+int poll_engine::wait(event_t *out, int max, int timeout) {
+    int nfds = poll(fds, high + 1, timeout);
+    syscalls++;
+    if (nfds <= 0)
+	return nfds;
+    if (fds[0].revents) {
+	drain_wake_fd(fds[0].fd);
+	syscalls++;
+	fds[0].revents = 0;
+    }
+
+    // Hand out events round-robin starting where the last call stopped.
+    int n = 0;
+    if (next >= high)
+	next = 0;
+    for (int k = 0; k < high && n < max; k++) {
+	int i = (next + k) % high;
+	struct pollfd *pfd = &fds[i+1];
+	if (pfd->revents) {
+	    out[n].slot = i;
+	    out[n].op = EV_READY;
+	    out[n].revents = pfd->revents;
+	    pfd->revents = 0;
+	    n++;
+	}
+	if (n == max)
+	    next = i + 1;
+    }
+    return n;
+}
+
+/*
+ * epoll_engine
+ */
+
+// epoll_event.data for the wake() eventfd.
+#define EPOLL_WAKE_SLOT 0xffffffff
+
+epoll_engine *epoll_engine::create(int max_slots) {
+    int epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (epfd < 0)
+	return NULL;
+
+    int wakefd = wake_fd();
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN | EPOLLET;
+    ev.data.u32 = EPOLL_WAKE_SLOT;
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, wakefd, &ev) < 0) {
+	perror("epoll_ctl(EPOLL_CTL_ADD)");
+	exit(1);
+    }
+    return new epoll_engine(epfd, wakefd, max_slots);
+}
+
+epoll_engine::epoll_engine(int _epfd, int _wakefd, int max_slots)
+    : epfd(_epfd), wakefd(_wakefd), armed(max_slots, 0), ready(1024) {
+}
+
+epoll_engine::~epoll_engine() {
+    close(wakefd);
+    close(epfd);
+}
+
+void epoll_engine::wake() {
+    eventfd_write(wakefd, 1);
+}
+
+static uint32_t to_epoll(int events) {
+    uint32_t ev = EPOLLET;
+    if (events & POLLIN)
+	ev |= EPOLLIN;
+    if (events & POLLOUT)
+	ev |= EPOLLOUT;
+    return ev;
+}
+
+static int from_epoll(uint32_t ev) {
+    int revents = 0;
+    if (ev & EPOLLIN)
+	revents |= POLLIN;
+    if (ev & EPOLLOUT)
+	revents |= POLLOUT;
+    if (ev & EPOLLERR)
+	revents |= POLLERR;
+    if (ev & EPOLLHUP)
+	revents |= POLLHUP;
+    return revents;
+}
+
+void epoll_engine::add(int slot, int fd, int events) {
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = to_epoll(events);
+    ev.data.u32 = slot;
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+	perror("epoll_ctl(EPOLL_CTL_ADD)");
+	exit(1);
+    }
+    syscalls++;
+    armed[slot] = events;
+}
+
+void epoll_engine::modify(int slot, int fd, int events) {
+    // Edge-triggered readiness only fires on transitions, so a bit
+    // that is no longer wanted costs at most one spurious event. Only
+    // pay for epoll_ctl() when adding interest.
+    if ((events & ~armed[slot]) == 0)
+	return;
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = to_epoll(events | armed[slot]);
+    ev.data.u32 = slot;
+    if (epoll_ctl(epfd, EPOLL_CTL_MOD, fd, &ev) < 0) {
+	perror("epoll_ctl(EPOLL_CTL_MOD)");
+	exit(1);
+    }
+    syscalls++;
+    armed[slot] |= events;
+}
+
+void epoll_engine::remove(int slot, int fd) {
+    // close() drops the fd from the epoll set; no need for EPOLL_CTL_DEL.
+    armed[slot] = 0;
+}
+
+int epoll_engine::wait(event_t *out, int max, int timeout) {
+    if (max > (int)ready.size())
+	max = ready.size();
+    int nfds = epoll_wait(epfd, &ready[0], max, timeout);
+    syscalls++;
+    int n = 0;
+    for (int i = 0; i < nfds; i++) {
+	if (ready[i].data.u32 == EPOLL_WAKE_SLOT) {
+	    drain_wake_fd(wakefd);
+	    syscalls++;
+	    continue;
+	}
+	out[n].slot = ready[i].data.u32;
+	out[n].op = EV_READY;
+	out[n].revents = from_epoll(ready[i].events);
+	n++;
+    }
+    return nfds < 0 ? nfds : n;
+}
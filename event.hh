@@ -0,0 +1,129 @@
+#ifndef EVENT_HH_
+#define EVENT_HH_
+/*
+ * Event engines. An engine watches a set of connection slots and
+ * reports which of them are ready. Interest and readiness are
+ * expressed with the poll() bits POLLIN, POLLOUT, POLLERR and POLLHUP
+ * regardless of the underlying mechanism.
+ */
+#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <vector>
+
+// What an event_t reports: readiness, or the completion of an
+// operation started with event_engine::connect(), write() or read().
+enum event_op { EV_READY = 0, EV_CONNECT, EV_WRITE, EV_READ, };
+
+struct event_t {
+    int slot;
+    enum event_op op;
+    // For EV_READY, the poll() bits that are ready.
+    int revents;
+    // For completions, the syscall result or -errno. For EV_READ, buf
+    // holds res bytes and stays valid until the next wait().
+    int res;
+    char *buf;
+};
+
+class event_engine {
+public:
+    event_engine() : syscalls(0) {}
+    virtual ~event_engine() {}
+
+    virtual const char *name() const = 0;
+
+    // TRUE if readiness is only reported on transitions. Callers must
+    // then drain a socket until EAGAIN before waiting again.
+    virtual int edge_triggered() const = 0;
+
+    // Start, change, or stop watching fd on behalf of slot.
+    virtual void add(int slot, int fd, int events) = 0;
+    virtual void modify(int slot, int fd, int events) = 0;
+    virtual void remove(int slot, int fd) = 0;
+
+    // Wait up to timeout ms and fill in at most max ready slots.
+    // Return the number filled in, or -1 with errno set.
+    virtual int wait(event_t *out, int max, int timeout) = 0;
+
+    // Make a wait() in progress, or the next one, return promptly.
+    // Safe to call from any thread.
+    virtual void wake() = 0;
+
+    // TRUE if the engine performs socket I/O itself. Only such engines
+    // implement the operations below; each reports its result as an
+    // event from a later wait(). Operations may be queued until flush()
+    // or the next wait().
+    virtual int completions() const { return 0; }
+    virtual void connect(int slot, int fd, const struct sockaddr *addr, socklen_t len) {}
+    virtual void write(int slot, int fd, const struct iovec *iov, int iovcnt) {}
+    virtual void read(int slot, int fd) {}
+    virtual void flush() {}
+
+    // STATIC. Create the engine called name ("epoll", "uring" or
+    // "poll") able to watch slots 0..max_slots-1. If name is
+    // unavailable on this system, fall back to epoll and then poll.
+    // Return NULL if name is unknown.
+    static event_engine *create(const char *name, int max_slots);
+
+    // Syscalls made on the owner's behalf, by everything but wake();
+    // the owner may reset it.
+    long long syscalls;
+};
+
+/*
+ * poll() over the slot table. Every wait costs O(highest slot in use),
+ * but works everywhere.
+ */
+class poll_engine : public event_engine {
+public:
+    poll_engine(int max_slots);
+    ~poll_engine();
+
+    const char *name() const { return "poll"; }
+    int edge_triggered() const { return 0; }
+    void add(int slot, int fd, int events);
+    void modify(int slot, int fd, int events);
+    void remove(int slot, int fd);
+    int wait(event_t *out, int max, int timeout);
+    void wake();
+
+private:
+    // fds[0] is the wake() eventfd; slot i is fds[i+1].
+    struct pollfd *fds;
+    int fds_len;
+    // One past the highest slot ever added; poll() need not look further.
+    int high;
+    // Where the previous wait() stopped handing out events, so a full
+    // out array does not starve the slots above it.
+    int next;
+};
+
+/*
+ * Edge-triggered epoll. Every wait costs O(ready slots).
+ */
+class epoll_engine : public event_engine {
+public:
+    // Return NULL if epoll is not available.
+    static epoll_engine *create(int max_slots);
+    ~epoll_engine();
+
+    const char *name() const { return "epoll"; }
+    int edge_triggered() const { return 1; }
+    void add(int slot, int fd, int events);
+    void modify(int slot, int fd, int events);
+    void remove(int slot, int fd);
+    int wait(event_t *out, int max, int timeout);
+    void wake();
+
+private:
+    epoll_engine(int _epfd, int _wakefd, int max_slots);
+
+    int epfd, wakefd;
+    // The interest currently registered with the kernel for each slot.
+    std::vector<int> armed;
+    std::vector<struct epoll_event> ready;
+};
+
+#endif /* EVENT_HH_ */
@@ -0,0 +1,347 @@
+/*
+ * goofy-bench: time goofy's per-request code paths in isolation, so a
+ * change that makes the generator slower shows up here before it shows
+ * up as a slower server in a load test. Each benchmark runs until it
+ * has taken at least -t ms and reports nanoseconds and heap
+ * allocations per operation. Fixtures are the size of a large run:
+ * 10k URLs, 50 request headers, 100k connection slots.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <getopt.h>
+#include <new>
+
+#include <string>
+#include <vector>
+
+#include "goofy.hh"
+#include "slots.hh"
+
+#define BENCH_URLS 10000
+#define BENCH_HEADERS 50
+#define BENCH_SLOTS 100000
+// Reactors whose statistics are merged into each report.
+#define BENCH_REACTORS 4
+
+// Heap allocations so far. goofy-bench is single threaded.
+static unsigned long long allocations;
+
+void *operator new(size_t n) {
+    allocations++;
+    void *p = malloc(n ? n : 1);
+    if (p == NULL)
+	throw std::bad_alloc();
+    return p;
+}
+
+void *operator new[](size_t n) {
+    return operator new(n);
+}
+
+// Every delete frees through here. Kept out of line so that the
+// compiler cannot pair the free() with the new expressions it inlines
+// these into and warn that they don't match.
+__attribute__((noinline)) static void release(void *p) {
+    free(p);
+}
+
+void operator delete(void *p) noexcept {
+    release(p);
+}
+
+void operator delete[](void *p) noexcept {
+    release(p);
+}
+
+void operator delete(void *p, size_t) noexcept {
+    release(p);
+}
+
+void operator delete[](void *p, size_t) noexcept {
+    release(p);
+}
+
+// Results go here so that the compiler cannot drop the work.
+static volatile long long sink;
+
+static std::vector<std::string> url_fixtures;
+static request_template *request_fixture;
+static slot_pool *slot_fixture;
+static std::vector<int> slot_order;
+static wave_stat stat_fixtures[BENCH_REACTORS];
+static std::string response_length, response_chunked;
+
+/*
+ * Each benchmark does n operations.
+ */
+
+static void bench_url_parse(long long n) {
+    for (long long i = 0; i < n; i++) {
+	url u(url_fixtures[i % BENCH_URLS]);
+	sink += u.port();
+    }
+}
+
+static void bench_request_template(long long n) {
+    url u(url_fixtures[0]);
+    for (long long i = 0; i < n; i++) {
+	request_template t(u, "GET", NULL, headers, "HTTP/1.1");
+	sink += t.tail.size();
+    }
+}
+
+static void bench_request_iov(long long n) {
+    struct iovec iov[REQUEST_IOV_MAX];
+    char cnt[REQUEST_CNT_MAX];
+    for (long long i = 0; i < n; i++) {
+	int cnt_len = request_cnt(i, cnt);
+	int iovcnt = request_iov(*request_fixture, NULL, cnt, cnt_len, 0, iov, 1);
+	sink += iovcnt + request_length(*request_fixture, NULL, cnt_len);
+    }
+}
+
+static void feed_responses(const std::string &r, long long n) {
+    http_response parser;
+    for (long long i = 0; i < n; i++) {
+	parser.reset();
+	const char *p = r.data();
+	int left = r.size();
+	while (left > 0 && !parser.done() && !parser.failed()) {
+	    int used = parser.feed(p, left);
+	    p += used;
+	    left -= used;
+	}
+	sink += parser.status();
+    }
+}
+
+static void bench_http_response(long long n) {
+    feed_responses(response_length, n);
+}
+
+static void bench_http_chunked(long long n) {
+    feed_responses(response_chunked, n);
+}
+
+static void bench_slot_pool(long long n) {
+    // Take slots as a wave would, then give each back once in the
+    // order their connections might finish: the shuffled order, less
+    // the slots a short last wave didn't take.
+    int *taken = new int[BENCH_SLOTS];
+    for (long long done = 0; done < n; ) {
+	int k = n - done < BENCH_SLOTS ? n - done : BENCH_SLOTS;
+	for (int i = 0; i < k; i++)
+	    taken[i] = slot_fixture->get();
+	for (int i = 0; i < BENCH_SLOTS; i++) {
+	    if (slot_order[i] < k)
+		slot_fixture->put(taken[slot_order[i]]);
+	}
+	done += k;
+    }
+    sink += taken[0];
+    delete[] taken;
+}
+
+static void bench_report_merge(long long n) {
+    wave_stat total;
+    for (long long i = 0; i < n; i++) {
+	total.clear();
+	for (int r = 0; r < BENCH_REACTORS; r++)
+	    total.merge(stat_fixtures[r]);
+	sink += total.requests;
+    }
+}
+
+static void bench_percentiles(long long n) {
+    static const double ps[] = { 50, 90, 99, 99.9 };
+    const histogram &h = stat_fixtures[0].latency[PHASE_TOTAL];
+    for (long long i = 0; i < n; i++)
+	for (int k = 0; k < 4; k++)
+	    sink += h.percentile(ps[k]);
+}
+
+struct benchmark {
+    const char *name;
+    void (*run)(long long n);
+};
+
+static const benchmark benchmarks[] = {
+    { "url_parse", bench_url_parse },
+    { "request_template", bench_request_template },
+    { "request_iov", bench_request_iov },
+    { "http_response", bench_http_response },
+    { "http_chunked", bench_http_chunked },
+    { "slot_pool", bench_slot_pool },
+    { "report_merge", bench_report_merge },
+    { "percentiles", bench_percentiles },
+};
+
+static void make_fixtures() {
+    char buf[256];
+    unsigned seed = 1;
+
+    // URLs of every shape url::parse() handles.
+    for (int i = 0; i < BENCH_URLS; i++) {
+	switch (i % 4) {
+	case 0:
+	    snprintf(buf, sizeof(buf), "http://www%d.example.com/", i);
+	    break;
+	case 1:
+	    snprintf(buf, sizeof(buf), "https://API.Example.com:%d/v1/items/%d?fields=id,name&page=%d",
+		     8000 + i % 1000, i, i % 97);
+	    break;
+	case 2:
+	    snprintf(buf, sizeof(buf), "http://10.%d.%d.%d:8080/static/img/%d.png",
+		     i % 256, i / 256 % 256, i % 200, i);
+	    break;
+	default:
+	    snprintf(buf, sizeof(buf), "http://[2001:db8::%x]:%d/search?q=%d",
+		     i, 1024 + i, i);
+	}
+	url_fixtures.push_back(buf);
+    }
+
+    for (int i = 0; i < BENCH_HEADERS; i++) {
+	snprintf(buf, sizeof(buf), "X-Bench-Header-%d: value-%d-%08x", i, i, i * 2654435761u);
+	headers.push_back(buf);
+    }
+    url u(url_fixtures[1]);
+    request_fixture = new request_template(u, "GET", NULL, headers, "HTTP/1.1");
+
+    slot_fixture = new slot_pool(BENCH_SLOTS);
+    for (int i = 0; i < BENCH_SLOTS; i++)
+	slot_order.push_back(i);
+    for (int i = BENCH_SLOTS - 1; i > 0; i--)
+	std::swap(slot_order[i], slot_order[rand_r(&seed) % (i + 1)]);
+
+    // A typical response, and the same body in chunks.
+    std::string body(1000, 'x');
+    response_length = "HTTP/1.1 200 OK\r\n"
+	"Date: Mon, 12 Oct 2026 10:00:00 GMT\r\n"
+	"Server: bench\r\n"
+	"Content-Type: text/html; charset=utf-8\r\n"
+	"Cache-Control: max-age=3600\r\n"
+	"Content-Length: 1000\r\n"
+	"\r\n" + body;
+    response_chunked = "HTTP/1.1 200 OK\r\n"
+	"Date: Mon, 12 Oct 2026 10:00:00 GMT\r\n"
+	"Server: bench\r\n"
+	"Content-Type: text/html; charset=utf-8\r\n"
+	"Transfer-Encoding: chunked\r\n"
+	"\r\n";
+    for (int i = 0; i < 4; i++)
+	response_chunked += "fa\r\n" + body.substr(0, 250) + "\r\n";
+    response_chunked += "0\r\n\r\n";
+
+    // One reactor's period of a busy run: a spread of statuses,
+    // errors, addresses and latencies.
+    for (int r = 0; r < BENCH_REACTORS; r++) {
+	wave_stat &s = stat_fixtures[r];
+	s.opened = s.connected = s.closed = s.requests = 10000;
+	s.bytes = 10000000;
+	static const int codes[] = { 200, 204, 301, 304, 404, 500, 502, 503 };
+	for (int k = 0; k < 8; k++)
+	    s.http_code[codes[k]] = 1000 + k;
+	s.connect[ECONNREFUSED] = 10;
+	s.read[ECONNRESET] = 5;
+	s.response[HTTP_TRUNCATED] = 3;
+	s.timeout[PHASE_TTFB] = 2;
+	for (int a = 0; a < 16; a++) {
+	    s.addr_opened[a] = 625;
+	    s.addr_responses[a] = 625;
+	}
+	for (int i = 0; i < 10000; i++) {
+	    int64_t v = 200 + rand_r(&seed) % 50000;
+	    s.latency[PHASE_CONNECT].record(v / 10);
+	    s.latency[PHASE_TTFB].record(v);
+	    s.latency[PHASE_TOTAL].record(v + v / 4);
+	}
+    }
+}
+
+static double now_ns() {
+    struct timespec ts;
+    if (clock_gettime(CLOCK_MONOTONIC, &ts) < 0) {
+	perror("clock_gettime");
+	exit(1);
+    }
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/**
+ * Run b with more and more operations until a run takes min_ns, then
+ * print that run's cost per operation.
+ */
+static void run(const benchmark &b, double min_ns) {
+    long long n = 1;
+    double elapsed;
+    unsigned long long allocs;
+
+    while (1) {
+	allocs = allocations;
+	double start = now_ns();
+	b.run(n);
+	elapsed = now_ns() - start;
+	allocs = allocations - allocs;
+	if (elapsed >= min_ns)
+	    break;
+	// Aim a little past min_ns, growing at most 100 times a step.
+	double grow = elapsed > 0 ? min_ns * 1.2 / elapsed : 100;
+	n = (long long) (n * (grow < 100 ? grow : 100)) + 1;
+    }
+    printf("%-18s %12lld %10.1f %10.2f\n", b.name, n, elapsed / n, (double) allocs / n);
+}
+
+static void usage() {
+    fprintf(stderr, "Usage: goofy-bench [args] [benchmark...]\n"
+	    "  -t ms            run each benchmark at least ms; default 500\n"
+	    "  -l               list the benchmarks\n");
+    exit(1);
+}
+
+int main(int argc, char **argv) {
+    int min_ms = 500;
+    int nbench = sizeof(benchmarks) / sizeof(benchmarks[0]);
+    int ch;
+
+    while ((ch = getopt(argc, argv, "t:l")) != -1) {
+	switch (ch) {
+	case 't':
+	    min_ms = atoi(optarg);
+	    break;
+	case 'l':
+	    for (int i = 0; i < nbench; i++)
+		printf("%s\n", benchmarks[i].name);
+	    exit(0);
+	default:
+	    usage();
+	}
+    }
+    if (min_ms <= 0)
+	usage();
+    for (int i = optind; i < argc; i++) {
+	int found = 0;
+	for (int k = 0; k < nbench; k++)
+	    found |= (strcmp(argv[i], benchmarks[k].name) == 0);
+	if (!found) {
+	    fprintf(stderr, "unknown benchmark: %s\n", argv[i]);
+	    exit(1);
+	}
+    }
+
+    make_fixtures();
+
+    printf("%-18s %12s %10s %10s\n", "benchmark", "ops", "ns/op", "allocs/op");
+    for (int k = 0; k < nbench; k++) {
+	int wanted = (optind == argc);
+	for (int i = optind; i < argc; i++)
+	    wanted |= (strcmp(argv[i], benchmarks[k].name) == 0);
+	if (wanted)
+	    run(benchmarks[k], min_ms * 1e6);
+    }
+    return 0;
+}
@@ -0,0 +1,624 @@
+/*
+ * goofy-target: a small, fast HTTP/1.x server to point goofy at, so
+ * that goofy's own ceiling can be measured over loopback without a
+ * real web server in the way. Each thread has its own SO_REUSEPORT
+ * listener and edge-triggered epoll loop. Responses are rendered once
+ * at startup; each may be delayed, drawn from a mix of statuses, or
+ * replaced by a reset or a bare close.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <errno.h>
+#include <getopt.h>
+#include <signal.h>
+#include <time.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include <algorithm>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "timer.hh"
+
+// The longest request head we take.
+#define TARGET_HEAD_MAX 8192
+
+struct target_conn {
+    int fd;
+    // Request bytes read and not yet used.
+    char in[TARGET_HEAD_MAX];
+    int in_len;
+    // Request body bytes still to be read and dropped.
+    long long skip;
+    // The response being sent: its header, whether it has a body, and
+    // how much has gone.
+    const std::string *head;
+    int with_body;
+    int sent;
+    // Close once the response is sent.
+    int closing;
+    // Waiting out -d before responding.
+    int delayed;
+    // Stopped reading with the buffer full of pipelined requests.
+    int stalled;
+};
+
+// A response status and its share of the mix.
+struct target_status {
+    int code;
+    int weight;
+    // 204 and 304 responses never have a body.
+    int bodiless;
+    // The header, keeping the connection open and closing it.
+    std::string keep, close;
+};
+
+static const char *listen_address = "0.0.0.0";
+static int port = 8080;
+static int delay_ms;
+static int body_size = 100;
+static std::vector<target_status> statuses;
+static int status_weights;
+// Percent of requests answered by a reset, and by a close.
+static double reset_pct, close_pct;
+static std::string body;
+static int max_fds;
+
+static void usage() {
+    fprintf(stderr, "Usage: goofy-target [args]\n"
+	    "  -a addr          listen on addr; default all\n"
+	    "  -p port          listen on port; default 8080\n"
+	    "  -j threads       number of threads; default 1\n"
+	    "  -d ms            wait ms before each response\n"
+	    "  -s bytes         response body size; default 100\n"
+	    "  -c code:weight[,code:weight...]\n"
+	    "                   mix of response statuses; default 200\n"
+	    "  -x pct           reset the connection instead of answering pct%%\n"
+	    "                   of requests\n"
+	    "  -z pct           close the connection instead of answering pct%%\n"
+	    "                   of requests\n"
+	    "  -f fds           maximum number of sockets; default the hard limit\n");
+    exit(1);
+}
+
+static int64_t now_ms() {
+    struct timespec ts;
+    if (clock_gettime(CLOCK_MONOTONIC, &ts) < 0) {
+	perror("clock_gettime");
+	exit(1);
+    }
+    return (int64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static const char *reason(int code) {
+    switch (code) {
+    case 200: return "OK";
+    case 204: return "No Content";
+    case 301: return "Moved Permanently";
+    case 302: return "Found";
+    case 304: return "Not Modified";
+    case 400: return "Bad Request";
+    case 403: return "Forbidden";
+    case 404: return "Not Found";
+    case 429: return "Too Many Requests";
+    case 500: return "Internal Server Error";
+    case 502: return "Bad Gateway";
+    case 503: return "Service Unavailable";
+    case 504: return "Gateway Timeout";
+    default: return "Unknown";
+    }
+}
+
+/**
+ * Parse "code:weight,..." into the status mix. Return FALSE if it
+ * makes no sense.
+ */
+static int parse_statuses(char *spec) {
+    for (char *s = strtok(spec, ","); s != NULL; s = strtok(NULL, ",")) {
+	target_status st;
+	char *colon = strchr(s, ':');
+	st.code = atoi(s);
+	st.weight = colon ? atoi(colon + 1) : 1;
+	// 1xx responses are interim; a final one must follow.
+	if (st.code < 200 || st.code > 999 || st.weight < 0)
+	    return 0;
+	statuses.push_back(st);
+    }
+    return !statuses.empty();
+}
+
+/**
+ * Render each status's headers, for keep-alive and for close.
+ */
+static void render_statuses() {
+    char buf[256];
+    status_weights = 0;
+    for (size_t i = 0; i < statuses.size(); i++) {
+	target_status &st = statuses[i];
+	st.bodiless = (st.code == 204 || st.code == 304);
+	if (st.bodiless)
+	    snprintf(buf, sizeof(buf), "HTTP/1.1 %d %s\r\n", st.code, reason(st.code));
+	else
+	    snprintf(buf, sizeof(buf), "HTTP/1.1 %d %s\r\nContent-Length: %d\r\n",
+		     st.code, reason(st.code), body_size);
+	st.keep = std::string(buf) + "\r\n";
+	st.close = std::string(buf) + "Connection: close\r\n\r\n";
+	status_weights += st.weight;
+    }
+    if (status_weights == 0) {
+	fprintf(stderr, "status weights add up to 0\n");
+	exit(1);
+    }
+}
+
+class target_thread {
+public:
+    target_thread(int id);
+    void start() { thread = std::thread(&target_thread::run, this); }
+    void join() { thread.join(); }
+
+private:
+    void run();
+    void accept_all();
+    void handle(int fd, uint32_t events);
+    int read_requests(target_conn *c);
+    int next_request(target_conn *c);
+    int write_response(target_conn *c);
+    void resume(target_conn *c);
+    void drop(target_conn *c, int reset);
+
+    // xorshift64*, for the mix and the failures.
+    uint64_t random() {
+	rng ^= rng >> 12;
+	rng ^= rng << 25;
+	rng ^= rng >> 27;
+	return rng * 0x2545f4914f6cdd1dULL;
+    }
+    double percent() { return (random() >> 11) * (100.0 / 9007199254740992.0); }
+
+    int listener;
+    int epfd;
+    // Connections by fd, kept for the fd's next connection.
+    std::vector<target_conn *> conns;
+    timer_wheel *timers;
+    uint64_t rng;
+    std::thread thread;
+};
+
+target_thread::target_thread(int id) : conns(max_fds, (target_conn *) NULL) {
+    rng = ((0x9e3779b97f4a7c15ULL * (id + 1)) ^ now_ms()) | 1;
+    timers = delay_ms > 0 ? new timer_wheel(max_fds, now_ms()) : NULL;
+
+    struct sockaddr_in6 sa6;
+    struct sockaddr_in sa4;
+    struct sockaddr *sa;
+    socklen_t len;
+    int family;
+    memset(&sa6, 0, sizeof(sa6));
+    memset(&sa4, 0, sizeof(sa4));
+    if (inet_pton(AF_INET, listen_address, &sa4.sin_addr) == 1) {
+	sa4.sin_family = family = AF_INET;
+	sa4.sin_port = htons(port);
+	sa = (struct sockaddr *) &sa4;
+	len = sizeof(sa4);
+    }
+    else if (inet_pton(AF_INET6, listen_address, &sa6.sin6_addr) == 1) {
+	sa6.sin6_family = family = AF_INET6;
+	sa6.sin6_port = htons(port);
+	sa = (struct sockaddr *) &sa6;
+	len = sizeof(sa6);
+    }
+    else {
+	fprintf(stderr, "bad listen address: %s\n", listen_address);
+	exit(1);
+    }
+
+    // Every thread listens on the port; the kernel spreads connections
+    // over them.
+    int one = 1;
+    listener = socket(family, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if (listener < 0 ||
+	setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) < 0 ||
+	setsockopt(listener, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one)) < 0) {
+	perror("socket");
+	exit(1);
+    }
+    if (bind(listener, sa, len) < 0) {
+	perror("bind");
+	exit(1);
+    }
+    if (listen(listener, 65535) < 0) {
+	perror("listen");
+	exit(1);
+    }
+
+    epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (epfd < 0) {
+	perror("epoll_create1");
+	exit(1);
+    }
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.fd = listener;
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, listener, &ev) < 0) {
+	perror("epoll_ctl");
+	exit(1);
+    }
+}
+
+void target_thread::run() {
+    const int max_events = 1024;
+    struct epoll_event events[max_events];
+
+    while (1) {
+	int timeout = timers ? timers->next(now_ms()) : -1;
+	int n = epoll_wait(epfd, events, max_events, timeout);
+	if (n < 0) {
+	    if (errno == EINTR)
+		continue;
+	    perror("epoll_wait");
+	    exit(1);
+	}
+	for (int k = 0; k < n; k++) {
+	    if (events[k].data.fd == listener)
+		accept_all();
+	    else
+		handle(events[k].data.fd, events[k].events);
+	}
+
+	// Answer the requests whose delay is up.
+	if (timers != NULL) {
+	    int64_t now = now_ms();
+	    int fd;
+	    while ((fd = timers->expired(now)) >= 0) {
+		target_conn *c = conns[fd];
+		c->delayed = 0;
+		if (write_response(c))
+		    resume(c);
+	    }
+	}
+    }
+}
+
+/**
+ * Take every connection waiting on the listener.
+ */
+void target_thread::accept_all() {
+    while (1) {
+	int fd = accept4(listener, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+	if (fd < 0) {
+	    if (errno == EINTR || errno == ECONNABORTED)
+		continue;
+	    if (errno != EAGAIN && errno != EWOULDBLOCK)
+		perror("accept4");
+	    return;
+	}
+	if (fd >= max_fds) {
+	    close(fd);
+	    continue;
+	}
+	int one = 1;
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+	if (conns[fd] == NULL)
+	    conns[fd] = new target_conn;
+	target_conn *c = conns[fd];
+	c->fd = fd;
+	c->in_len = 0;
+	c->skip = 0;
+	c->head = NULL;
+	c->closing = c->delayed = c->stalled = 0;
+
+	struct epoll_event ev;
+	ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+	ev.data.fd = fd;
+	if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+	    perror("epoll_ctl");
+	    close(fd);
+	}
+    }
+}
+
+/**
+ * Close c, with a reset rather than a FIN if reset.
+ */
+void target_thread::drop(target_conn *c, int reset) {
+    if (reset) {
+	struct linger l = { 1, 0 };
+	setsockopt(c->fd, SOL_SOCKET, SO_LINGER, &l, sizeof(l));
+    }
+    if (timers != NULL)
+	timers->cancel(c->fd);
+    // Closing removes it from the epoll set.
+    close(c->fd);
+    c->fd = -1;
+}
+
+void target_thread::handle(int fd, uint32_t events) {
+    target_conn *c = conns[fd];
+    if (c == NULL || c->fd < 0)
+	return;
+    if (events & EPOLLERR) {
+	drop(c, 0);
+	return;
+    }
+    if ((events & EPOLLOUT) && c->head != NULL && !c->delayed) {
+	if (!write_response(c) || c->head != NULL)
+	    return;
+	resume(c);
+	if (c->fd < 0)
+	    return;
+    }
+    if (events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP))
+	read_requests(c);
+}
+
+/**
+ * Read until the socket would block, answering whole requests as they
+ * arrive. Return FALSE if the connection was closed.
+ */
+int target_thread::read_requests(target_conn *c) {
+    while (1) {
+	int n;
+	if (c->skip > 0) {
+	    // Body we don't look at.
+	    n = recv(c->fd, NULL, c->skip, MSG_TRUNC);
+	    if (n > 0) {
+		c->skip -= n;
+		continue;
+	    }
+	}
+	else {
+	    if (c->in_len == TARGET_HEAD_MAX) {
+		// Stalled behind a response; its end picks up from here.
+		if (c->head != NULL || c->delayed) {
+		    c->stalled = 1;
+		    return 1;
+		}
+		drop(c, 0);
+		return 0;
+	    }
+	    n = recv(c->fd, c->in + c->in_len, TARGET_HEAD_MAX - c->in_len, 0);
+	}
+	if (n < 0) {
+	    if (errno == EINTR)
+		continue;
+	    if (errno == EAGAIN || errno == EWOULDBLOCK)
+		return 1;
+	    drop(c, 0);
+	    return 0;
+	}
+	if (n == 0) {
+	    drop(c, 0);
+	    return 0;
+	}
+	if (c->skip == 0) {
+	    c->in_len += n;
+	    if (c->head == NULL && !next_request(c))
+		return 0;
+	}
+    }
+}
+
+/**
+ * Carry on with c after a response has gone: answer what is buffered,
+ * then read what was left waiting while the buffer was full.
+ */
+void target_thread::resume(target_conn *c) {
+    if (!next_request(c))
+	return;
+    if (c->stalled && c->head == NULL && !c->delayed) {
+	c->stalled = 0;
+	read_requests(c);
+    }
+}
+
+/**
+ * Answer the next whole request in c's buffer, unless a response is
+ * already under way. Return FALSE if the connection was closed.
+ */
+int target_thread::next_request(target_conn *c) {
+    while (c->head == NULL && !c->delayed) {
+	char *end = (char *) memmem(c->in, c->in_len, "\r\n\r\n", 4);
+	if (end == NULL)
+	    return 1;
+	end += 4;
+	*(end - 2) = 0;
+
+	// HTTP/1.1 keeps the connection unless told not to, and 1.0 drops
+	// it unless told to keep it.
+	char *eol = (char *) memchr(c->in, '\r', end - c->in);
+	int http11 = (eol - c->in >= 8 && memcmp(eol - 8, "HTTP/1.1", 8) == 0);
+	int head_only = (strncmp(c->in, "HEAD ", 5) == 0);
+	int keep = http11;
+	long long length = 0;
+	for (char *line = eol + 2; line < end - 2; ) {
+	    char *next = strstr(line, "\r\n");
+	    if (next == NULL)
+		next = end - 2;
+	    if (strncasecmp(line, "Content-Length:", 15) == 0)
+		length = strtoll(line + 15, NULL, 10);
+	    else if (strncasecmp(line, "Connection:", 11) == 0) {
+		char *v = line + 11;
+		while (*v == ' ')
+		    v++;
+		if (strncasecmp(v, "close", 5) == 0)
+		    keep = 0;
+		else if (strncasecmp(v, "keep-alive", 10) == 0)
+		    keep = 1;
+	    }
+	    line = next + 2;
+	}
+
+	if (length < 0) {
+	    drop(c, 0);
+	    return 0;
+	}
+
+	// Drop the request, and as much of its body as has come.
+	int used = end - c->in;
+	long long in_body = c->in_len - used < length ? c->in_len - used : length;
+	used += in_body;
+	memmove(c->in, c->in + used, c->in_len - used);
+	c->in_len -= used;
+	c->skip = length - in_body;
+
+	double p = percent();
+	if (p < reset_pct) {
+	    drop(c, 1);
+	    return 0;
+	}
+	if (p < reset_pct + close_pct) {
+	    drop(c, 0);
+	    return 0;
+	}
+
+	int w = random() % status_weights, i = 0;
+	while (w >= statuses[i].weight) {
+	    w -= statuses[i].weight;
+	    i++;
+	}
+	c->head = keep ? &statuses[i].keep : &statuses[i].close;
+	c->with_body = !head_only && !statuses[i].bodiless;
+	c->sent = 0;
+	c->closing = !keep;
+	if (timers != NULL) {
+	    c->delayed = 1;
+	    timers->schedule(c->fd, now_ms() + delay_ms);
+	    return 1;
+	}
+	if (!write_response(c))
+	    return 0;
+    }
+    return 1;
+}
+
+/**
+ * Send c's response as far as the socket allows. Return FALSE if the
+ * connection was closed.
+ */
+int target_thread::write_response(target_conn *c) {
+    int total = c->head->size() + (c->with_body ? body.size() : 0);
+    while (c->sent < total) {
+	struct iovec iov[2];
+	int iovcnt = 0;
+	int head_len = c->head->size();
+	if (c->sent < head_len) {
+	    iov[iovcnt].iov_base = (void *) (c->head->data() + c->sent);
+	    iov[iovcnt++].iov_len = head_len - c->sent;
+	}
+	if (c->with_body && body.size() > 0) {
+	    int off = c->sent > head_len ? c->sent - head_len : 0;
+	    iov[iovcnt].iov_base = (void *) (body.data() + off);
+	    iov[iovcnt++].iov_len = body.size() - off;
+	}
+	struct msghdr msg;
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = iov;
+	msg.msg_iovlen = iovcnt;
+	int n = sendmsg(c->fd, &msg, MSG_NOSIGNAL);
+	if (n < 0) {
+	    if (errno == EINTR)
+		continue;
+	    // EPOLLOUT brings us back.
+	    if (errno == EAGAIN || errno == EWOULDBLOCK)
+		return 1;
+	    drop(c, 0);
+	    return 0;
+	}
+	c->sent += n;
+    }
+    c->head = NULL;
+    if (c->closing) {
+	drop(c, 0);
+	return 0;
+    }
+    return 1;
+}
+
+int main(int argc, char **argv) {
+    int nthreads = 1;
+    int ch;
+
+    while ((ch = getopt(argc, argv, "a:p:j:d:s:c:x:z:f:")) != -1) {
+	switch (ch) {
+	case 'a':
+	    listen_address = optarg;
+	    break;
+	case 'p':
+	    port = atoi(optarg);
+	    break;
+	case 'j':
+	    nthreads = atoi(optarg);
+	    break;
+	case 'd':
+	    delay_ms = atoi(optarg);
+	    break;
+	case 's':
+	    body_size = atoi(optarg);
+	    break;
+	case 'c':
+	    if (!parse_statuses(optarg))
+		usage();
+	    break;
+	case 'x':
+	    reset_pct = atof(optarg);
+	    break;
+	case 'z':
+	    close_pct = atof(optarg);
+	    break;
+	case 'f':
+	    max_fds = atoi(optarg);
+	    break;
+	default:
+	    usage();
+	}
+    }
+    if (optind != argc || nthreads < 1 || port <= 0 || delay_ms < 0 || body_size < 0 ||
+	max_fds < 0 || reset_pct < 0 || close_pct < 0 || reset_pct + close_pct > 100)
+	usage();
+
+    if (statuses.empty()) {
+	target_status st;
+	st.code = 200;
+	st.weight = 1;
+	statuses.push_back(st);
+    }
+    render_statuses();
+    body.assign(body_size, 'x');
+
+    struct rlimit rlim;
+    if (getrlimit(RLIMIT_NOFILE, &rlim) < 0) {
+	perror("getrlimit");
+	exit(1);
+    }
+    if (max_fds == 0)
+	max_fds = std::min(rlim.rlim_max, (rlim_t) 1 << 20);
+    rlim.rlim_cur = std::max(rlim.rlim_cur, (rlim_t) max_fds);
+    rlim.rlim_max = std::max(rlim.rlim_max, (rlim_t) max_fds);
+    if (setrlimit(RLIMIT_NOFILE, &rlim) < 0) {
+	perror("setrlimit");
+	exit(1);
+    }
+    signal(SIGPIPE, SIG_IGN);
+
+    std::vector<target_thread *> threads;
+    for (int i = 0; i < nthreads; i++)
+	threads.push_back(new target_thread(i));
+    for (int i = 0; i < nthreads; i++)
+	threads[i]->start();
+    for (int i = 0; i < nthreads; i++)
+	threads[i]->join();
+    return 0;
+}
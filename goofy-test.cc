@@ -0,0 +1,121 @@
+/*
+ * goofy-test: check the requests goofy renders byte for byte, where a
+ * load test would only show a confused server. Exits non-zero if any
+ * check fails.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+
+#include "goofy.hh"
+
+static int failures;
+
+static void check(int ok, const char *what, const std::string &request) {
+    if (!ok) {
+	fprintf(stderr, "FAIL: %s in:\n%s\n", what, request.c_str());
+	failures++;
+    }
+}
+
+/*
+ * Write text to a new file in dir; return its path.
+ */
+static std::string write_file(const std::string &dir, const char *name, const char *text) {
+    std::string path = dir + "/" + name;
+    FILE *f = fopen(path.c_str(), "w");
+    if (f == NULL || fputs(text, f) < 0 || fclose(f) != 0) {
+	perror(path.c_str());
+	exit(1);
+    }
+    return path;
+}
+
+/*
+ * The whole of the request for t, or e if not NULL.
+ */
+static std::string render(const request_template &t, const corpus_entry *e) {
+    struct iovec iov[REQUEST_IOV_MAX];
+    int n = request_iov(t, e, "", 0, 0, iov, 1);
+    std::string r;
+    for (int i = 0; i < n; i++)
+	r.append((const char *) iov[i].iov_base, iov[i].iov_len);
+    const request_body *body = request_body_of(t, e);
+    check((int) r.size() == request_length(t, e, 0) + (body != NULL ? body->len : 0),
+	  "request_length() disagrees with request_iov()", r);
+    return r;
+}
+
+/*
+ * Check that r announces exactly the body it sends.
+ */
+static void check_length(const std::string &r, const char *body) {
+    size_t end = r.find("\r\n\r\n");
+    check(end != std::string::npos, "no end of headers", r);
+    if (end == std::string::npos)
+	return;
+    std::string head = r.substr(0, end + 2), sent = r.substr(end + 4);
+    int found = 0;
+    for (size_t p = head.find("Content-Length:"); p != std::string::npos;
+	 p = head.find("Content-Length:", p + 1))
+	found++;
+    if (body == NULL) {
+	check(found == 0, "Content-Length without a body", r);
+	check(sent.empty(), "body sent unannounced", r);
+	return;
+    }
+    char want[40];
+    snprintf(want, sizeof(want), "\r\nContent-Length: %d\r\n", (int) strlen(body));
+    check(found == 1, "not exactly one Content-Length", r);
+    check(head.find(want) != std::string::npos, "wrong Content-Length", r);
+    check(sent == body, "wrong body", r);
+}
+
+/*
+ * -b with -C: each corpus line sends its own body, or none, and
+ * announces just that.
+ */
+static void test_corpus_with_body() {
+    char dir[] = "/tmp/goofy-test.XXXXXX";
+    if (mkdtemp(dir) == NULL) {
+	perror("mkdtemp");
+	exit(1);
+    }
+    std::string b_path = write_file(dir, "b.txt", "from -b");
+    std::string item_path = write_file(dir, "item.json", "{\"id\": 1}");
+    std::string corpus_path = write_file(dir, "corpus",
+	"1 GET /products/1234\n"
+	"1 POST /cart <item.json | Content-Type: application/json\n"
+	"1 PUT /cart <item.json\n");
+
+    headers.push_back("X-Test: 1");
+    url u("http://example.com/");
+    request_body *body = open_body(b_path.c_str());
+    request_template t(u, "POST", body, headers, "HTTP/1.1");
+    request_corpus corpus(corpus_path.c_str());
+
+    check_length(render(t, NULL), "from -b");
+    check_length(render(t, &corpus.entry(0)), NULL);
+    check_length(render(t, &corpus.entry(1)), "{\"id\": 1}");
+    check_length(render(t, &corpus.entry(2)), "{\"id\": 1}");
+
+    unlink(corpus_path.c_str());
+    unlink(item_path.c_str());
+    unlink(b_path.c_str());
+    rmdir(dir);
+}
+
+int main() {
+    test_corpus_with_body();
+    if (failures > 0) {
+	fprintf(stderr, "%d checks failed\n", failures);
+	return 1;
+    }
+    printf("ok\n");
+    return 0;
+}
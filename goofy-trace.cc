@@ -0,0 +1,234 @@
+/*
+ * goofy-trace: Read a trace written by goofy -T and report on it after
+ * the fact, so one run can be sliced several ways. By default it
+ * rebuilds goofy's per-period results and latency columns and its
+ * end-of-run summary; -l lists every request's timeline instead.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+
+#include <algorithm>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "goofy.hh"
+
+// What finished during one reporting period.
+struct period {
+    period() : done(0), errs(0), other(0) {}
+    int done;
+    int errs;
+    std::map<int,int> http_code;
+    int other;
+    histogram latency;
+};
+
+void usage() {
+    fprintf(stderr, "Usage: goofy-trace [args] file\n"
+	    "  -r ms            milliseconds per reporting period; default 1000\n"
+	    "  -P phase         latency shown per period: connect, handshake, ttfb\n"
+	    "                   or total (default)\n"
+	    "  -l               list each request's timeline instead\n");
+    exit(1);
+}
+
+/**
+ * Return the latency of phase for r, or -1 if r never got that far.
+ */
+int64_t latency(const trace_record &r, int phase) {
+    switch (phase) {
+    case PHASE_CONNECT:
+	return r.connected ? r.connected - r.connecting : -1;
+    case PHASE_HANDSHAKE:
+	return r.handshaken ? r.handshaken - r.connected : -1;
+    case PHASE_TTFB:
+	// goofy times first bytes only of responses that finished.
+	return r.kind == TRACE_OK && r.first_byte ? r.first_byte - r.scheduled : -1;
+    default:
+	return r.kind == TRACE_OK ? r.done - r.scheduled : -1;
+    }
+}
+
+/**
+ * Describe how r ended in buf.
+ */
+const char *outcome(const trace_record &r, char *buf, size_t len) {
+    if (r.kind == TRACE_OK)
+	snprintf(buf, len, "%d", r.status);
+    else if (r.kind == TRACE_RESPONSE) {
+	strmap::const_iterator it = response_errors.find(r.err);
+	if (it != response_errors.end())
+	    snprintf(buf, len, "response: %s", it->second);
+	else
+	    snprintf(buf, len, "response: %d", r.err);
+    }
+    else if (r.kind == TRACE_TLS)
+	snprintf(buf, len, "tls: %s", tls_client::reason_string(r.err));
+    else if (r.kind == TRACE_TIMEOUT)
+	snprintf(buf, len, "timeout: %s", phase_names[r.err]);
+    else
+	snprintf(buf, len, "%s: %s", trace_kind_names[r.kind], strerror(r.err));
+    return buf;
+}
+
+/**
+ * List every request in the trace by request number.
+ */
+void list_requests(const trace_file &trace) {
+    std::vector<const trace_record *> recs;
+    for (uint64_t k = 0; k < trace.count(); k++)
+	recs.push_back(&trace.record(k));
+    std::sort(recs.begin(), recs.end(),
+	      [](const trace_record *a, const trace_record *b) {
+		  return a->request_number < b->request_number;
+	      });
+
+    printf("request  url thr      due launch  conn  hshk  ttfb total result\n"
+	   "------- ---- --- -------- ------ ----- ----- ----- ----- ------\n");
+    for (size_t k = 0; k < recs.size(); k++) {
+	const trace_record &r = *recs[k];
+	char buf[128];
+	printf("%7u %4u %3u %8.1f", r.request_number, r.url_number, r.reactor,
+	       (r.scheduled - trace.start()) / 1000.0);
+	printf(" %6.1f", (r.connecting - r.scheduled) / 1000.0);
+	for (int p = 0; p < PHASES; p++) {
+	    int64_t l = latency(r, p);
+	    if (l < 0)
+		printf(" %5s", "-");
+	    else
+		print_ms(l);
+	}
+	printf(" %s\n", outcome(r, buf, sizeof(buf)));
+    }
+}
+
+/**
+ * Display what finished in each period of interval microseconds, then
+ * a summary of the whole run.
+ */
+void report(const trace_file &trace, int64_t interval, int phase) {
+    std::map<int64_t, period> periods;
+    histogram cumulative[PHASES];
+    std::map<std::string, int> failures;
+
+    for (uint64_t k = 0; k < trace.count(); k++) {
+	const trace_record &r = trace.record(k);
+	period &p = periods[(r.done - trace.start()) / interval];
+	p.done++;
+	if (r.kind == TRACE_OK) {
+	    switch (r.status) {
+	    case 200:
+	    case 500:
+	    case 503:
+	    case 504:
+		p.http_code[r.status]++;
+		break;
+	    default:
+		p.other++;
+		break;
+	    }
+	}
+	else {
+	    char buf[128];
+	    p.errs++;
+	    failures[outcome(r, buf, sizeof(buf))]++;
+	}
+	for (int ph = 0; ph < PHASES; ph++) {
+	    int64_t l = latency(r, ph);
+	    if (l < 0)
+		continue;
+	    // Count each connection's connect and handshake once, as
+	    // goofy does, not once per request it carried.
+	    if ((ph == PHASE_CONNECT || ph == PHASE_HANDSHAKE) && !(r.flags & TRACE_FIRST))
+		continue;
+	    cumulative[ph].record(l);
+	    if (ph == phase)
+		p.latency.record(l);
+	}
+    }
+
+    char label[32];
+    snprintf(label, sizeof(label), "%s ms", phase_names[phase]);
+    printf("           | results                        | | %-26s|\n"
+	   "secs       done errs  200  500  503  504  xxx   p50   p90   p99 p99.9   max\n"
+	   "---------- ---- ---- ---- ---- ---- ---- ---- ----- ----- ----- ----- -----\n",
+	   label);
+    for (std::map<int64_t, period>::iterator it = periods.begin(); it != periods.end(); it++) {
+	period &p = it->second;
+	printf("%10.1f %4d %4d %4d %4d %4d %4d %4d", it->first * interval / 1000000.0,
+	       p.done, p.errs, p.http_code[200], p.http_code[500], p.http_code[503],
+	       p.http_code[504], p.other);
+	if (p.latency.count() > 0) {
+	    print_ms(p.latency.percentile(50));
+	    print_ms(p.latency.percentile(90));
+	    print_ms(p.latency.percentile(99));
+	    print_ms(p.latency.percentile(99.9));
+	    print_ms(p.latency.max());
+	}
+	printf("\n");
+    }
+
+    printf("\n"
+	   "latency ms      count   min  mean   p50   p90   p99 p99.9   max\n"
+	   "--------- ---------- ----- ----- ----- ----- ----- ----- -----\n");
+    for (int ph = 0; ph < PHASES; ph++) {
+	const histogram &h = cumulative[ph];
+	printf("%-9s %10llu", phase_names[ph], (unsigned long long) h.count());
+	print_ms(h.min());
+	print_ms(h.mean());
+	print_ms(h.percentile(50));
+	print_ms(h.percentile(90));
+	print_ms(h.percentile(99));
+	print_ms(h.percentile(99.9));
+	print_ms(h.max());
+	printf("\n");
+    }
+
+    if (failures.size() > 0) {
+	printf("\nfailures\n");
+	for (std::map<std::string, int>::iterator it = failures.begin(); it != failures.end(); it++)
+	    printf("\t%s: %d\n", it->first.c_str(), it->second);
+    }
+}
+
+int main(int argc, char **argv) {
+    int64_t interval = 1000000;
+    int phase = PHASE_TOTAL;
+    int list = 0;
+    int ch;
+
+    while ((ch = getopt(argc, argv, "r:P:l")) != -1) {
+	switch (ch) {
+	case 'r':
+	    interval = atoi(optarg) * 1000LL;
+	    break;
+	case 'P':
+	    for (phase = 0; phase < PHASES; phase++) {
+		if (strcmp(optarg, phase_names[phase]) == 0)
+		    break;
+	    }
+	    if (phase == PHASES)
+		usage();
+	    break;
+	case 'l':
+	    list = 1;
+	    break;
+	default:
+	    usage();
+	}
+    }
+    if (optind != argc - 1 || interval <= 0)
+	usage();
+
+    trace_file trace(argv[optind]);
+    if (list)
+	list_requests(trace);
+    else
+	report(trace, interval, phase);
+    return 0;
+}
@@ -11,7 +11,6 @@
 #include <stdlib.h>
 #include <getopt.h>
 #include <string.h>
-#include <poll.h>
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <fcntl.h>
@@ -21,133 +20,45 @@
 #include <time.h>
 #include <sys/time.h>
 #include <errno.h>
+#include <poll.h>
+#include <signal.h>
 #include <sys/resource.h>
+#include <sys/timerfd.h>
 
 #include <map>
 #include <iostream>
 #include <vector>
+#include <thread>
 
-#include "url.hh"
-
-typedef std::map<int,int> intmap;
-typedef std::map<int, const char *> strmap;
-typedef std::vector<std::string> strvec;
-typedef std::vector<url> urlvec;
-typedef std::vector<struct sockaddr_in> addrvec;
-
-struct wave_stat {
-    wave_stat() {
-	clear();
-    }
-    void clear() {
-	opened = closed = connected = 0;
-	socket.clear();
-	connect.clear();
-	write.clear();
-	http_code.clear();
-    }
-    int opened;
-    int connected;
-    int closed;
-    intmap socket;
-    intmap connect;
-    intmap read;
-    intmap write;
-    intmap http_code;
-};
-
-class time_interval {
-public:
-    time_interval(const char *_label) : label(_label) {
-	set(0);
-	mark();
-    }
-
-    // Set this.marked to the current time.
-    void mark() {
-	gettod(&marked);
-    }
-
-    // Set this.marked to the given timeval.
-    void mark(struct timeval *t) {
-	memcpy(&marked, t, sizeof(marked));
-    }
-
-    // Set and get the interval used by passed().
-    void set(int _interval) { interval = _interval; }
-    int get() const { return interval; }
-
-    // Return TRUE if now-this.marked exceeds the interval.
-    int passed(struct timeval *now) const {
-	struct timeval delta;
-	timeval_subtract(&delta, now, &marked);
-	//printf("%s: %d, %d, %d, %d, %s\n", label, interval, delta.tv_sec, delta.tv_usec, delta.tv_sec*1000000+delta.tv_usec, delta.tv_sec*1000000+delta.tv_usec > interval ? "true" : "false" );
-	return  ((delta.tv_sec*1000000+delta.tv_usec) > interval);
-    }
-
-    // Fill in out with time elapsed since last mark.
-    void since(struct timeval *out) const {
-	struct timeval now;
-	gettod(&now);
-	timeval_subtract(out, &now, &marked);
-    }
-
-    // STATIC. Fill in now with the current time of day.
-    static void gettod(struct timeval *now) {
-	if (gettimeofday(now, NULL) < 0) {
-	    perror("gettimeofday");
-	    exit(1);
-	}
-    }
-
-    // STATIC. Fill in RESULT with X-Y.
-    // Return 1 if the difference is negative, otherwise 0.
-    static int timeval_subtract (struct timeval *result, const struct timeval *x, const struct timeval *y)
-    {
-	struct timeval _y(*y);
-
-	/* Perform the carry for the later subtraction by updating y. */
-	if (x->tv_usec < _y.tv_usec) {
-	    int nsec = (_y.tv_usec - x->tv_usec) / 1000000 + 1;
-	    _y.tv_usec -= 1000000 * nsec;
-	    _y.tv_sec += nsec;
-	}
-	if (x->tv_usec - _y.tv_usec > 1000000) {
-	    int nsec = (x->tv_usec - _y.tv_usec) / 1000000;
-	    _y.tv_usec += 1000000 * nsec;
-	    _y.tv_sec -= nsec;
-	}
-
-	/* Compute the time remaining to wait.
-	   tv_usec is certainly positive. */
-	result->tv_sec = x->tv_sec - _y.tv_sec;
-	result->tv_usec = x->tv_usec - _y.tv_usec;
-
-	/* Return 1 if result is negative. */
-	return x->tv_sec < _y.tv_sec;
-    }
-
-    struct timeval marked, now;
-    int interval;
-    const char *label;
-};
+#include "goofy.hh"
+#include "reactor.hh"
+#include "report.hh"
+#include "profile.hh"
 
-enum conn_state { CONN_UNUSED = 0, CONN_CONNECTING, CONN_ESTABLISHED, };
-struct conn_info_t {
-    int request_number;
-    int url_number;
-    enum conn_state state;
-    struct timeval connecting;
-    struct timeval connected;
-};
-
-struct wave_stat wave_stats;
-struct conn_info_t *conn_info;
+std::vector<reactor *> reactors;
+unsigned snapshot_epoch;
 int request_count;
-int debug;
-struct pollfd *fds;
-int fds_len = 0;
+// The latency phase shown in each report, and everything counted since
+// the start.
+int report_phase = PHASE_TOTAL;
+wave_stat totals;
+// How late waves were launched, this period and since the start.
+histogram period_lag, cumulative_lag;
+volatile sig_atomic_t interrupted;
+// The -o output, or NULL.
+report_output *output;
+// The addresses new waves connect to.
+const address_table *current_addresses;
 strmap http_codes;
+// Show goofy's own costs under each report (-M).
+int self_reporting;
+// When the last report was written, the process's CPU use then, and
+// how long writing it took; reports skipped since; and the whole run's
+// costs.
+int64_t last_report_at, report_us;
+struct rusage last_usage;
+int reports_skipped;
+self_stat self_totals;
 
 void usage() {
     fprintf(stderr, "Usage: goofy [args] url [url...]\n"
@@ -158,86 +69,119 @@ void usage() {
             "  -m secs          total seconds to run test; default is unlimited\n"
             "  -f fds           maximum number of sockets to request from the os\n"
             "  -h hdr           add hdr (\"Header: value\") to each request\n"
+            "  -w ms[,ms[,ms]]  give up on connects, first bytes and whole responses\n"
+            "                   taking longer than these; 0 for no limit\n"
+            "  -D               discard response bodies without reading them\n"
+            "  -I               sample each connection's TCP_INFO: round-trip times,\n"
+            "                   retransmissions and losses\n"
+            "  -M               show goofy's own CPU time, syscalls and event loop\n"
+            "                   delays under each report\n"
+            "  -X method        request method; default GET, or POST with -b\n"
+            "  -b file          send the contents of file as each request's body\n"
+            "  -e engine        event engine: epoll (default), uring or poll\n"
+            "  -j threads       number of reactor threads; default is 1\n"
+            "  -k num[:depth]   send num HTTP/1.1 requests per connection, pipelining\n"
+            "                   up to depth at a time; default is one HTTP/1.0 request\n"
+            "  -2 num[:streams] send num requests per connection over cleartext\n"
+            "                   HTTP/2, up to streams (default 100) at a time\n"
+            "  -P phase         latency shown in reports: connect, handshake, ttfb\n"
+            "                   or total (default)\n"
+            "  -T file[:num]    trace every request to file, keeping the last num;\n"
+            "                   default 1000000; read it with goofy-trace\n"
+            "  -o fmt[:file]    also write each report to file (default stdout,\n"
+            "                   replacing the table) as json (JSON Lines) or csv\n"
+            "  -R secs          look the URLs' hosts up again every secs\n"
+            "  -C file          send weighted requests from corpus file instead of\n"
+            "                   the URLs' paths; see README\n"
+            "  -L profile       open connections at a changing rate instead of -n,\n"
+            "                   one -t tick (default 10) at a time; see README\n"
+            "  -s ip[:lo-hi]    connect from local address ip, binding ports lo-hi\n"
+            "                   or any free port; repeat or separate with commas\n"
+            "                   to rotate through several\n"
+            "  -S resume        resume https sessions: none (default), id or ticket\n"
             "  -d               debug\n");
     exit(1);
 }
 
-/* Set fd to be non-blocking. */
-void setnonblocking(int fd) {
-    long arg;
-    if ((arg = fcntl(fd, F_GETFL, NULL)) < 0) {
-	perror("fcntl(F_GETFL)");
-	exit(1);
-    }
-    arg |= O_NONBLOCK;
-    if (fcntl(fd, F_SETFL, arg) < 0) {
-	perror("fcntl(F_SETFL)");
-	exit(1);
-    }
+/**
+ * Split a wave of num new connections, due at time_interval::usec()
+ * time start, across the reactors. Request numbers and URLs are handed
+ * out as if one reactor opened them all.
+ */
+void open_connections(int num, int &current_url, int64_t start) {
+    static int first = 0;
+    int n = reactors.size();
+
+    for (int k = 0; k < n; k++) {
+	wave_order o;
+	o.num = num / n + (k < num % n);
+	if (o.num == 0)
+	    continue;
+	o.first_request = request_count;
+	o.first_url = current_url;
+	o.start = start;
+	request_count += o.num * requests_per_conn;
+	o.addresses = current_addresses;
+	current_url = (current_url + o.num) % urls.size();
+	reactors[(first + k) % n]->order(o);
+    }
+    // Spread the remainder of uneven waves around.
+    first = (first + num % n) % n;
 }
 
-/* Set fd to be blocking. */
-void setblocking(int fd) {
-    long arg;
-    if ((arg = fcntl(fd, F_GETFL, NULL)) < 0) {
-	perror("fcntl(F_GETFL)");
-	exit(1);
-    }
-    arg &= ~O_NONBLOCK;
-    if (fcntl(fd, F_SETFL, arg) < 0) {
-	perror("fcntl(F_SETFL)");
+/*
+ * Return t in microseconds.
+ */
+static int64_t tv_usec(const struct timeval &t) {
+    return (int64_t) t.tv_sec * 1000000 + t.tv_usec;
+}
+
+/**
+ * Fill in self with goofy's costs since the last report, given what the
+ * reactors counted in stats. Waves are due every tick microseconds.
+ */
+void collect_self(self_stat &self, const wave_stat &stats, int64_t tick) {
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) < 0) {
+	perror("getrusage");
 	exit(1);
     }
+    int64_t now = time_interval::usec();
+    self.period_us = now - last_report_at;
+    self.user_us = tv_usec(usage.ru_utime) - tv_usec(last_usage.ru_utime);
+    self.sys_us = tv_usec(usage.ru_stime) - tv_usec(last_usage.ru_stime);
+    self.report_us = report_us;
+    self.skipped = reports_skipped;
+    // Behind if a wave went out after the next was due, a report was
+    // missed, or a reactor had no time to spare over a whole tick or
+    // more.
+    self.behind = (stats.loop_lag.max() > tick || period_lag.max() > tick ||
+		   self.skipped > 0 ||
+		   (self.period_us >= tick && stats.busiest_us * 10 > self.period_us * 9));
+    last_report_at = now;
+    last_usage = usage;
+    reports_skipped = 0;
+
+    self_totals.period_us += self.period_us;
+    self_totals.user_us += self.user_us;
+    self_totals.sys_us += self.sys_us;
+    self_totals.report_us += self.report_us;
+    self_totals.skipped += self.skipped;
+    self_totals.behind += self.behind;
 }
 
 /**
- * Initiate num new non-blocking connections to addr.
+ * Gather every reactor's statistics since the last call into total.
  */
-void open_connections(int num, const addrvec &addrs, int &current_url) {
-    int i, j;
-
-    for (i = 0; i < num; ++i) {
-	// Find the first available slot.
-	for (j = 0; j < fds_len; j++) {
-	    if (conn_info[j].state == CONN_UNUSED)
-		break;
-	}
-	if (j == fds_len) {
-	    fprintf(stderr, "out of fds\n");
-	    exit(1);
-	}
-
-	// Create the socket.
-	int fd = socket(AF_INET, SOCK_STREAM, 0);
-	if (fd < 0) {
-	    wave_stats.socket[errno]++;
-	    continue;
-	}
-
-	// Select the next address;
-	const struct sockaddr *addr = (struct sockaddr *) &addrs[current_url];
-	conn_info[j].url_number = current_url;
-	current_url = (current_url + 1) % addrs.size();
-
-	// Use non-blocking connects which correctly fail with EINPROGRESS.
-	setnonblocking(fd);
-	if (! (connect(fd, (struct sockaddr *) addr, sizeof(*addr))<0
-	       && errno == EINPROGRESS)) {
-	    wave_stats.connect[errno]++;
-	    close(fd);
-	    continue;
-	}
-
-	// Record the socket. Request POLLOUT so poll() informs us on connect.
-	fds[j].fd = fd;
-	fds[j].events = POLLIN|POLLOUT;
-	conn_info[j].state = CONN_CONNECTING;
-	conn_info[j].request_number = request_count++;
-	time_interval::gettod(&conn_info[j].connecting);
-	wave_stats.opened++;
-
-	if (debug)
-	    printf("open: fds %d, fd %d\n", j, fd);
+void collect_stats(wave_stat &total) {
+    snapshot_epoch++;
+    for (size_t i = 0; i < reactors.size(); i++)
+	reactors[i]->request_snapshot(snapshot_epoch);
+    total.clear();
+    for (size_t i = 0; i < reactors.size(); i++) {
+	while (!reactors[i]->snapshot_ready(snapshot_epoch))
+	    std::this_thread::yield();
+	total.merge(reactors[i]->snapshot());
     }
 }
 
@@ -268,27 +212,152 @@ void report_errors(strmap &errmap, intmap &map, const char *label) {
 }
 
 /**
- * Display events since the last reporting period, then reset the counters.
+ * Display TLS failure reasons from map, prefixed by label.
+ */
+void report_tls_errors(intmap &map, const char *label) {
+    if (map.size() > 0) {
+	std::cout << "\t" << label << ": ";
+	for (intmap::iterator it = map.begin(); it != map.end(); it++) {
+	    std::cout << tls_client::reason_string(it->first) << ":" << it->second << " ";
+	}
+	std::cout << std::endl;
+    }
+}
+
+/**
+ * Display missed deadlines from map by phase, prefixed by label.
+ */
+void report_timeouts(intmap &map, const char *label) {
+    if (map.size() > 0) {
+	std::cout << "\t" << label << ": ";
+	for (intmap::iterator it = map.begin(); it != map.end(); it++) {
+	    std::cout << phase_names[it->first] << ":" << it->second << " ";
+	}
+	std::cout << std::endl;
+    }
+}
+
+/**
+ * Display how many connections had each count in map, prefixed by
+ * label. With nonzero, leave out those that had none.
  */
-void report_connections(time_interval *start) {
+void report_counts(intmap &map, const char *label, int nonzero) {
+    intmap::iterator it = map.begin();
+    if (nonzero && it != map.end() && it->first == 0)
+	it++;
+    if (it == map.end())
+	return;
+    std::cout << "\t" << label << ": ";
+    for (; it != map.end(); it++) {
+	std::cout << it->first << ":" << it->second << " ";
+    }
+    std::cout << std::endl;
+}
+
+/**
+ * Display the median and 99th percentile of each TCP_INFO round-trip
+ * time sampled, and the connections that had to retransmit or lost
+ * segments.
+ */
+void report_tcp(wave_stat &stats) {
+    int any = 0;
+    for (int m = 0; m < TCP_METRICS; m++) {
+	const histogram &h = stats.tcp[m];
+	if (h.count() == 0)
+	    continue;
+	printf("%s %s %.1f/%.1f", any ? "" : "\ttcp ms p50/p99:", tcp_metric_names[m],
+	       h.percentile(50) / 1000.0, h.percentile(99) / 1000.0);
+	any = 1;
+    }
+    if (any)
+	printf("\n");
+    report_counts(stats.syn_retries, "syn retries", 1);
+    report_counts(stats.retransmits, "retransmits", 1);
+    report_counts(stats.lost, "lost", 1);
+}
+
+/**
+ * With -M, display goofy's own costs over the period: CPU as a share of
+ * one core, time spent opening waves, handling I/O and writing the last
+ * report, syscalls, and the latest a reactor took up a wave.
+ */
+void report_self(const self_stat &self, const wave_stat &stats) {
+    double period = self.period_us > 0 ? self.period_us : 1;
+    printf("\tself: cpu %.1f%% (user %.1f%%, sys %.1f%%), launch %.1f ms, io %.1f ms, "
+	   "report %.1f ms, %lld syscalls, loop lag %.1f ms\n",
+	   100 * (self.user_us + self.sys_us) / period, 100 * self.user_us / period,
+	   100 * self.sys_us / period, stats.launch_us / 1000.0, stats.dispatch_us / 1000.0,
+	   self.report_us / 1000.0, stats.syscalls, stats.loop_lag.max() / 1000.0);
+}
+
+/**
+ * Display events since the last reporting period, then reset the
+ * counters. start is when the test began, and waves are due every tick
+ * microseconds.
+ */
+void report_connections(int64_t start, int64_t tick) {
     static int rows = 0;
+    wave_stat wave_stats;
+    self_stat self;
+
+    collect_stats(wave_stats);
+    totals.merge(wave_stats);
+    collect_self(self, wave_stats, tick);
+
+    // Structured output gets every period, even empty ones, and
+    // replaces the table if it goes to stdout.
+    if (output != NULL) {
+	output->period((time_interval::usec() - start) / 1000000.0, wave_stats, period_lag, self);
+	if (output->to_stdout()) {
+	    cumulative_lag.merge(period_lag);
+	    period_lag.clear();
+	    return;
+	}
+    }
 
     if (rows == 0) {
-	printf("     | delta      | | total | | results                   |\n"
-	       "secs  new estb clos pend estb errs  200  500  503  504  xxx\n"
-	       "---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ----\n");
+	char label[32];
+	snprintf(label, sizeof(label), "%s ms", phase_names[report_phase]);
+	if (h2_streams > 0) {
+	    // Streams opened and in flight, apart from connections.
+	    printf("     | delta                | | total      | | results                   | | %-26s|\n"
+		   "secs  new estb clos strm reqs pend estb strm errs  200  500  503  504  xxx   p50   p90   p99 p99.9   max   lag\n"
+		   "---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ----- ----- ----- ----- ----- -----\n",
+		   label);
+	}
+	else if (keepalive) {
+	    // With keep-alive, requests completed are not connections closed.
+	    printf("     | delta           | | total | | results                   | | %-26s|\n"
+		   "secs  new estb clos reqs pend estb errs  200  500  503  504  xxx   p50   p90   p99 p99.9   max   lag\n"
+		   "---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ----- ----- ----- ----- ----- -----\n",
+		   label);
+	}
+	else {
+	    printf("     | delta      | | total | | results                   | | %-26s|\n"
+		   "secs  new estb clos pend estb errs  200  500  503  504  xxx   p50   p90   p99 p99.9   max   lag\n"
+		   "---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ----- ----- ----- ----- ----- -----\n",
+		   label);
+	}
     }
     rows++;
 
     static int skip_if_nothing_happened = 0;
-    int nothing_happened = (wave_stats.opened == 0 &&
+    int nothing_happened = (period_lag.count() == 0 &&
+			    !self.behind &&
+			    wave_stats.opened == 0 &&
 			    wave_stats.connected == 0 &&
 			    wave_stats.closed == 0 &&
+			    wave_stats.requests == 0 &&
+			    wave_stats.streams == 0 &&
 			    wave_stats.socket.size() == 0 &&
+			    wave_stats.bind.size() == 0 &&
 			    wave_stats.connect.size() == 0 &&
 			    wave_stats.read.size() == 0 &&
 			    wave_stats.write.size() == 0 &&
-			    wave_stats.http_code.size() == 0);
+			    wave_stats.http_code.size() == 0 &&
+			    wave_stats.response.size() == 0 &&
+			    wave_stats.tls.size() == 0 &&
+			    wave_stats.timeout.size() == 0);
     if (nothing_happened) {
 	if (skip_if_nothing_happened) {
 	    return;
@@ -302,12 +371,16 @@ void report_connections(time_interval *start) {
     }
 
     intmap::iterator it;
-    int connecting = 0, established = 0, errs = 0, http_errs = 0;
+    int connecting = wave_stats.connecting, established = wave_stats.established;
+    int errs = 0, http_errs = 0;
 
     // Sum all syscall errors.
     for (it = wave_stats.socket.begin(); it != wave_stats.socket.end(); it++) {
 	errs += it->second;
     }
+    for (it = wave_stats.bind.begin(); it != wave_stats.bind.end(); it++) {
+	errs += it->second;
+    }
     for (it = wave_stats.connect.begin(); it != wave_stats.connect.end(); it++) {
 	errs += it->second;
     }
@@ -317,6 +390,15 @@ void report_connections(time_interval *start) {
     for (it = wave_stats.write.begin(); it != wave_stats.write.end(); it++) {
 	errs += it->second;
     }
+    for (it = wave_stats.response.begin(); it != wave_stats.response.end(); it++) {
+	errs += it->second;
+    }
+    for (it = wave_stats.tls.begin(); it != wave_stats.tls.end(); it++) {
+	errs += it->second;
+    }
+    for (it = wave_stats.timeout.begin(); it != wave_stats.timeout.end(); it++) {
+	errs += it->second;
+    }
     // Sum the HTTP codes to report collectively.
     for (it = wave_stats.http_code.begin(); it != wave_stats.http_code.end(); it++) {
 	switch (it->first) {
@@ -330,64 +412,144 @@ void report_connections(time_interval *start) {
 	    break;
 	}
     }
-    // Sum statuses.
-    for (int i = 0; i < fds_len; ++i) {
-	switch (conn_info[i].state) {
-	case CONN_UNUSED:
-	    break;
-	case CONN_CONNECTING:
-	    connecting++;
-	    break;
-	case CONN_ESTABLISHED:
-	    established++;
-	    break;
-	}
+    printf("%4ld %4d %4d %4d ", (long) ((time_interval::usec() - start) / 1000000), wave_stats.opened, wave_stats.connected, wave_stats.closed);
+    if (h2_streams > 0)
+	printf("%4d ", wave_stats.streams);
+    if (keepalive)
+	printf("%4d ", wave_stats.requests);
+    printf("%4d %4d ", connecting, established);
+    if (h2_streams > 0)
+	printf("%4d ", wave_stats.open_streams);
+    printf("%4d %4d %4d %4d %4d %4d", errs, wave_stats.http_code[200], wave_stats.http_code[500], wave_stats.http_code[503], wave_stats.http_code[504], http_errs);
+    const histogram &h = wave_stats.latency[report_phase];
+    if (h.count() > 0) {
+	print_ms(h.percentile(50));
+	print_ms(h.percentile(90));
+	print_ms(h.percentile(99));
+	print_ms(h.percentile(99.9));
+	print_ms(h.max());
     }
-
-    struct timeval since;
-    start->since(&since);
-    printf("%4lu %4d %4d %4d %4d %4d %4d %4d %4d %4d %4d %4d\n", since.tv_sec, wave_stats.opened, wave_stats.connected, wave_stats.closed, connecting, established, errs, wave_stats.http_code[200], wave_stats.http_code[500], wave_stats.http_code[503], wave_stats.http_code[504], http_errs);
+    else {
+	printf(" %5s %5s %5s %5s %5s", "-", "-", "-", "-", "-");
+    }
+    // The latest any wave this period was launched.
+    if (period_lag.count() > 0)
+	print_ms(period_lag.max());
+    else
+	printf(" %5s", "-");
+    printf("\n");
+    if (self.behind) {
+	printf("\tbehind: loop lag %.1f ms, wave lag %.1f ms, %d reports skipped, busiest reactor %d%%\n",
+	       wave_stats.loop_lag.max() / 1000.0, period_lag.max() / 1000.0, self.skipped,
+	       (int) (100 * wave_stats.busiest_us / self.period_us));
+    }
+    if (self_reporting)
+	report_self(self, wave_stats);
+    cumulative_lag.merge(period_lag);
+    period_lag.clear();
     report_errors(wave_stats.socket, "socket");
+    report_errors(wave_stats.bind, "bind");
     report_errors(wave_stats.connect, "connect");
     report_errors(wave_stats.read, "read");
     report_errors(wave_stats.write, "write");
+    report_errors(response_errors, wave_stats.response, "response");
+    report_tls_errors(wave_stats.tls, "tls");
+    report_timeouts(wave_stats.timeout, "timeout");
+    report_tcp(wave_stats);
     wave_stats.http_code.erase(200);
     wave_stats.http_code.erase(500);
     wave_stats.http_code.erase(503);
     wave_stats.http_code.erase(504);
     report_errors(http_codes, wave_stats.http_code, "http");
 
-    wave_stats.clear();
-
     fflush(stdout);
 }
 
 /**
- * Clean up a connection slot.
+ * Display one row of the summary: how many values h holds, and their
+ * mean and percentiles in milliseconds.
  */
-void close_connection(int i) {
-    close(fds[i].fd);
-    wave_stats.closed++;
-    fds[i].fd = fds[i].events = 0;
-    conn_info[i].state = CONN_UNUSED;
-
-    // poll() can return POLLIN with an empty read and POLLHUP at the
-    // same time. Prevent this from being called again.
-    fds[i].revents &= ~(POLLIN | POLLHUP);
+void summary_row(const char *label, const histogram &h) {
+    printf("%-9s %10llu", label, (unsigned long long) h.count());
+    print_ms(h.min());
+    print_ms(h.mean());
+    print_ms(h.percentile(50));
+    print_ms(h.percentile(90));
+    print_ms(h.percentile(99));
+    print_ms(h.percentile(99.9));
+    print_ms(h.max());
+    printf("\n");
 }
 
 /**
- * Get the socket error for a connection slot.
+ * Display every phase's latency over the whole run.
  */
-int get_sock_error(int i) {
-    int optval;
-    socklen_t optlen;
-    optlen = sizeof(optval);
-    if (getsockopt(fds[i].fd, SOL_SOCKET, SO_ERROR, &optval, &optlen)< 0) {
-	perror("getsockopt(SO_ERROR, SOL_SOCKET");
-	exit(1);
+void report_summary() {
+    if (output != NULL) {
+	output->summary(totals, cumulative_lag, self_totals);
+	if (output->to_stdout())
+	    return;
     }
-    return optval;
+    printf("\n"
+	   "latency ms      count   min  mean   p50   p90   p99 p99.9   max\n"
+	   "--------- ---------- ----- ----- ----- ----- ----- ----- -----\n");
+    for (int p = 0; p < PHASES; p++)
+	summary_row(phase_names[p], totals.latency[p]);
+    summary_row("lag", cumulative_lag);
+    summary_row("loop lag", totals.loop_lag);
+
+    if (tcp_sampling) {
+	printf("\n"
+	       "tcp ms          count   min  mean   p50   p90   p99 p99.9   max\n"
+	       "--------- ---------- ----- ----- ----- ----- ----- ----- -----\n");
+	for (int m = 0; m < TCP_METRICS; m++)
+	    summary_row(tcp_metric_names[m], totals.tcp[m]);
+	printf("\n");
+	report_counts(totals.syn_retries, "syn retries", 0);
+	report_counts(totals.retransmits, "retransmits", 0);
+	report_counts(totals.lost, "lost", 0);
+    }
+
+    printf("\nreceived %.1f MB\n", totals.bytes / 1e6);
+    if (self_totals.behind > 0)
+	printf("goofy fell behind in %d period%s; see above\n", self_totals.behind,
+	       self_totals.behind == 1 ? "" : "s");
+    if (self_reporting && totals.requests > 0) {
+	printf("self: cpu %.2f s user, %.2f s sys; %.1f us cpu and %.1f syscalls per request\n",
+	       self_totals.user_us / 1e6, self_totals.sys_us / 1e6,
+	       (double) (self_totals.user_us + self_totals.sys_us) / totals.requests,
+	       (double) totals.syscalls / totals.requests);
+    }
+    if (totals.handshakes > 0) {
+	printf("tls: %d handshakes, %d resumed (%.1f%%)\n", totals.handshakes,
+	       totals.resumed, 100.0 * totals.resumed / totals.handshakes);
+    }
+
+    // With more than one address, show how the load was spread.
+    if (naddresses.load() > 1) {
+	printf("\n"
+	       "address                                        opened   errors    resps\n"
+	       "--------------------------------------------- -------- -------- --------\n");
+	for (int a = 0; a < naddresses.load(); a++) {
+	    printf("%-45s %8d %8d %8d\n", addresses[a].name, totals.addr_opened[a],
+		   totals.addr_errors[a], totals.addr_responses[a]);
+	}
+    }
+
+    if (sources.size() > 0) {
+	printf("\n"
+	       "source                                         opened   errors\n"
+	       "--------------------------------------------- -------- --------\n");
+	for (size_t s = 0; s < sources.size(); s++) {
+	    printf("%-45s %8d %8d\n", sources[s].name, totals.src_opened[s],
+		   totals.src_errors[s]);
+	}
+    }
+    fflush(stdout);
+}
+
+void handle_sigint(int sig) {
+    interrupted = 1;
 }
 
 /**
@@ -438,19 +600,27 @@ void init_http_codes() {
 }
 
 int main(int argc, char **argv) {
-    time_interval wave_interval("wave"), report_interval("report"), start("start");
+    time_interval wave_interval("wave"), report_interval("report");
     const char *wave_spec, *p;
     char ch;
-    int num, stop_after, unique, wave_limit, no_wave_limit;
+    const char *engine_name;
+    std::string trace_path;
+    load_profile *profile = NULL;
+    const char *method = NULL;
+    request_body *body = NULL;
+    int wave_spec_given = 0;
+    int64_t resolve_interval = 0;
+    int num, stop_after, wave_limit, no_wave_limit, nthreads;
     rlim_t max_fds;
-    strvec headers;
 
     num = debug = stop_after = unique = wave_limit = 0;
     no_wave_limit = 1;
     // default wave spec is just one wave
     wave_spec = "1000:1";
     max_fds = 256;
-    while ((ch = getopt(argc, argv, "un:t:r:df:m:h:")) != -1) {
+    engine_name = "epoll";
+    nthreads = 1;
+    while ((ch = getopt(argc, argv, "un:t:r:df:m:h:e:j:k:2:P:T:o:R:s:S:L:C:X:b:DIMw:")) != -1) {
 	switch (ch) {
 	case 'u':
 	    unique = 1;
@@ -460,6 +630,7 @@ int main(int argc, char **argv) {
 	    break;
 	case 't':
 	    wave_spec = optarg;
+	    wave_spec_given = 1;
 	    break;
 	case 'r':
 	    report_interval.set(atoi(optarg)*1000);
@@ -476,6 +647,107 @@ int main(int argc, char **argv) {
 	case 'h':
 	    headers.push_back(optarg);
 	    break;
+	case 'e':
+	    engine_name = optarg;
+	    break;
+	case 'j':
+	    nthreads = atoi(optarg);
+	    break;
+	case 'k':
+	    keepalive = 1;
+	    requests_per_conn = atoi(optarg);
+	    p = strchr(optarg, ':');
+	    if (p != NULL)
+		pipeline_depth = atoi(p+1);
+	    break;
+	case '2':
+	    keepalive = 1;
+	    requests_per_conn = atoi(optarg);
+	    h2_streams = 100;
+	    p = strchr(optarg, ':');
+	    if (p != NULL)
+		h2_streams = atoi(p+1);
+	    if (h2_streams < 1)
+		usage();
+	    break;
+	case 'P':
+	    for (report_phase = 0; report_phase < PHASES; report_phase++) {
+		if (strcmp(optarg, phase_names[report_phase]) == 0)
+		    break;
+	    }
+	    if (report_phase == PHASES)
+		usage();
+	    break;
+	case 'T':
+	    trace_path = optarg;
+	    break;
+	case 's':
+	    for (char *spec = strtok(optarg, ","); spec != NULL; spec = strtok(NULL, ",")) {
+		source s;
+		if (!parse_source(spec, &s)) {
+		    fprintf(stderr, "bad source address: %s\n", spec);
+		    exit(1);
+		}
+		sources.push_back(s);
+	    }
+	    break;
+	case 'S':
+	    if (strcmp(optarg, "none") == 0)
+		tls_resumption = TLS_RESUME_NONE;
+	    else if (strcmp(optarg, "id") == 0)
+		tls_resumption = TLS_RESUME_ID;
+	    else if (strcmp(optarg, "ticket") == 0)
+		tls_resumption = TLS_RESUME_TICKET;
+	    else
+		usage();
+	    break;
+	case 'w':
+	    connect_timeout = atoi(optarg);
+	    p = strchr(optarg, ',');
+	    if (p != NULL) {
+		ttfb_timeout = atoi(p+1);
+		p = strchr(p+1, ',');
+		if (p != NULL)
+		    total_timeout = atoi(p+1);
+	    }
+	    break;
+	case 'D':
+	    discard = 1;
+	    break;
+	case 'I':
+	    tcp_sampling = 1;
+	    break;
+	case 'M':
+	    self_reporting = 1;
+	    break;
+	case 'X':
+	    method = optarg;
+	    break;
+	case 'b':
+	    body = open_body(optarg);
+	    break;
+	case 'C':
+	    corpus = new request_corpus(optarg);
+	    if (debug)
+		printf("corpus: %zu requests\n", corpus->size());
+	    break;
+	case 'L': {
+	    std::string error;
+	    profile = load_profile::create(optarg, error);
+	    if (profile == NULL) {
+		fprintf(stderr, "%s\n", error.c_str());
+		usage();
+	    }
+	    break;
+	}
+	case 'R':
+	    resolve_interval = atoi(optarg) * 1000000LL;
+	    break;
+	case 'o':
+	    output = report_output::create(optarg);
+	    if (output == NULL)
+		usage();
+	    break;
 	default:
 	    usage();
 	}
@@ -488,24 +760,85 @@ int main(int argc, char **argv) {
 	no_wave_limit = 0;
     }
 
+    // A profile ticks often enough to smooth its rate, for as long as
+    // it lasts, and the run ends soon after unless -m says otherwise.
+    if (profile != NULL) {
+	if (!wave_spec_given)
+	    wave_interval.set(10000);
+	if (report_interval.get() == 0)
+	    report_interval.set(1000000);
+	if (wave_interval.get() > 0) {
+	    wave_limit = (profile->duration() + wave_interval.get() - 1) / wave_interval.get();
+	    no_wave_limit = 0;
+	}
+	if (stop_after == 0)
+	    stop_after = (profile->duration() + 999999) / 1000000;
+	num = 1;
+    }
+
     if (report_interval.get() == 0) {
 	report_interval.set(wave_interval.get());
     }
-    if (num == 0 || wave_interval.get() == 0 || report_interval.get() == 0) {
+    if (num == 0 || wave_interval.get() == 0 || report_interval.get() == 0 ||
+	nthreads < 1 || requests_per_conn < 1 || pipeline_depth < 1 ||
+	pipeline_depth > PIPELINE_MAX) {
 	usage();
     }
+    // Each reactor binds its own share of a -s port range.
+    for (size_t s = 0; s < sources.size(); s++) {
+	if (sources[s].port_lo != 0 && sources[s].port_hi - sources[s].port_lo + 1 < nthreads) {
+	    fprintf(stderr, "-s %s: fewer ports than -j threads\n", sources[s].name);
+	    exit(1);
+	}
+    }
 
     argc -= optind;
     argv += optind;
     if (argc < 1)
 	usage();
 
-    urlvec urls;
     while (*argv) {
       url url(*argv++);
       urls.push_back(url);
     }
-    url url = urls[0];
+    // The uring engine does its own reads and writes, which TLS would
+    // have to sit between.
+    for (size_t i = 0; i < urls.size(); i++) {
+	if (urls[i].protocol() == "https" && strcmp(engine_name, "uring") == 0) {
+	    fprintf(stderr, "https needs a readiness engine; using epoll\n");
+	    engine_name = "epoll";
+	}
+    }
+    // HTTP/2 is spoken only in the clear, and its requests have no
+    // bodies; the framing sits between us and the socket, so it needs
+    // a readiness engine too.
+    if (h2_streams > 0) {
+	int bodies = (body != NULL);
+	for (size_t i = 0; corpus != NULL && i < corpus->size(); i++)
+	    bodies |= (corpus->entry(i).body != NULL);
+	for (size_t i = 0; i < urls.size(); i++) {
+	    if (urls[i].protocol() != "http") {
+		fprintf(stderr, "-2 needs http URLs: %s\n", urls[i].full().c_str());
+		exit(1);
+	    }
+	}
+	if (bodies) {
+	    fprintf(stderr, "-2 cannot send request bodies\n");
+	    exit(1);
+	}
+	if (strcmp(engine_name, "uring") == 0) {
+	    fprintf(stderr, "-2 needs a readiness engine; using epoll\n");
+	    engine_name = "epoll";
+	}
+    }
+    if (method == NULL)
+	method = (body != NULL ? "POST" : "GET");
+    for (size_t i = 0; i < urls.size(); i++) {
+	templates.push_back(request_template(urls[i], method, body, headers,
+					     keepalive ? "HTTP/1.1" : "HTTP/1.0"));
+	if (h2_streams > 0)
+	    h2_requests.push_back(h2_request(urls[i], method, headers));
+    }
 
     // Decide how many fds we can use.
     struct rlimit rlim;
@@ -520,203 +853,137 @@ int main(int argc, char **argv) {
 	exit(1);
     }
 
-    // Allocate/initialize various data structures.
-    fds_len = rlim.rlim_cur;
-    fds = (struct pollfd *)calloc(fds_len, sizeof(struct pollfd));
-    conn_info = (struct conn_info_t *)calloc(fds_len, sizeof(struct conn_info_t));
     init_http_codes();
-    wave_stats.clear();
 
-    addrvec addrs;
-    for (int i = 0; i < urls.size(); i++) {
-      struct hostent *h = gethostbyname(urls[i].host().c_str());
-      if (h == NULL) {
-	fprintf(stderr, "cannot resolve host: %s\n", urls[i].host().c_str());
-	exit(1);
-      }
-
-      struct sockaddr_in addr;
-      memset(&addr, 0, sizeof(addr));
-      addr.sin_family = AF_INET;
-      addr.sin_port = htons(url.port());
-      memcpy(&addr.sin_addr.s_addr, h->h_addr, h->h_length);
-      addrs.push_back(addr);
-    }
-
-    int current_url = 0;
-
-    // Mark time and kick off the first wave.
-    struct timeval now;
-    time_interval::gettod(&now);
-    start.mark(&now);
-    if (no_wave_limit || wave_limit-- > 0) {
-      open_connections(num, addrs, current_url);
-    }
-    report_connections(&start);
-
-    int wait_interval = std::min(wave_interval.get(), report_interval.get())/1000;
-    while (1) {
-	if (stop_after > 0) {
-	    struct timeval since;
-	    start.since(&since);
-	    if (since.tv_sec > stop_after) {
-		break;
-	    }
+    if (!trace_path.empty()) {
+	uint64_t records = 1000000;
+	size_t colon = trace_path.rfind(':');
+	if (colon != std::string::npos) {
+	    records = strtoull(trace_path.c_str() + colon + 1, NULL, 10);
+	    trace_path.erase(colon);
 	}
+	if (records == 0)
+	    usage();
+	tracer = new trace_file(trace_path.c_str(), records);
+    }
 
-	int nfds = poll(fds, fds_len, wait_interval);
-	if (nfds < 0) {
-	    perror("poll");
-	    exit(1);
-	}
+    // Look up every host at once before starting.
+    resolver names(urls);
+    current_addresses = names.resolve();
 
-	time_interval::gettod(&now);
-	if (wave_interval.passed(&now)) {
-	    if (no_wave_limit || wave_limit-- > 0) {
-	      open_connections(num, addrs, current_url);
-	    }
-	    wave_interval.mark(&now);
-	}
+    // Each reactor owns an equal share of the connection slots.
+    int slots = rlim.rlim_cur / nthreads;
+    for (int i = 0; i < nthreads; i++) {
+	reactors.push_back(new reactor(i, nthreads, slots, engine_name));
+	reactors.back()->start();
+    }
 
-	if (report_interval.passed(&now)) {
-	    report_connections(&start);
-	    report_interval.mark(&now);
-	}
+    int current_url = 0;
 
-	if (nfds == 0) {
-	    continue;
-	}
+    // ^C ends the test early, with a summary. No SA_RESTART, so it
+    // interrupts the wait below.
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = handle_sigint;
+    sigaction(SIGINT, &sa, NULL);
+    // sendfile() has no MSG_NOSIGNAL.
+    signal(SIGPIPE, SIG_IGN);
+
+    int timer = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+    if (timer < 0) {
+	perror("timerfd_create");
+	exit(1);
+    }
 
-	for (int i = 0; i < fds_len; ++i) {
-	    // Presumably a non-blocking connect error?
-	    if (fds[i].revents & POLLERR) {
-		fds[i].revents &= ~POLLERR;
+    // Waves and reports are due at fixed offsets from the start on the
+    // monotonic clock, so neither a slow pass through the loop nor a
+    // change to the time of day moves the ones that follow.
+    int64_t start = time_interval::usec();
+    if (tracer != NULL)
+	tracer->set_start(start);
+    last_report_at = start;
+    if (getrusage(RUSAGE_SELF, &last_usage) < 0) {
+	perror("getrusage");
+	exit(1);
+    }
+    int64_t next_wave = start, next_report = start;
+    int64_t next_resolve = start + resolve_interval;
+    while (!interrupted) {
+	int64_t now = time_interval::usec();
+	if (stop_after > 0 && (now - start) / 1000000 > stop_after)
+	    break;
 
-		int err = get_sock_error(i);
-		wave_stats.connect[err]++;
-		close_connection(i);
+	// Launch every wave that is due. A late wave still carries its
+	// intended start, so its latencies include the delay.
+	while (next_wave <= now && (no_wave_limit || wave_limit > 0)) {
+	    wave_limit--;
+	    if (profile != NULL) {
+		int n = profile->quota(next_wave - start, wave_interval.get());
 		if (debug)
-		    printf("fd %d err: %d\n", fds[i].fd, err);
+		    printf("profile rate %.1f/s: %d\n", profile->rate(next_wave - start), n);
+		if (n > 0)
+		    open_connections(n, current_url, next_wave);
 	    }
-
-	    // Non-blocking connect succeeded or failed.
-	    if (fds[i].revents & POLLOUT) {
-		fds[i].revents &= ~POLLOUT;
-
-		int err = get_sock_error(i);
-		if (err == 0) {
-		    // Connect succeeded. Stop polling for write.
-		    fds[i].events &= ~POLLOUT;
-		    wave_stats.connected++;
-		    conn_info[i].state = CONN_ESTABLISHED;
-		    time_interval::gettod(&conn_info[i].connected);
-
-		    // For now, use blocking IO.
-		    setblocking(fds[i].fd);
-		    if (debug)
-			printf("fd %d: connect\n", fds[i].fd);
-
-		    struct timeval diff;
-		    time_interval::timeval_subtract(&diff, &conn_info[i].connected, &conn_info[i].connecting);
-		    time_t delta = diff.tv_sec*1000000+diff.tv_usec;
-		    if (delta > 1000000) {
-			printf("%d connect time: %lu\n", conn_info[i].request_number, delta);
-		    }
-
-		    // Build the URL and request headers.
-		    char request[8192];
-		    int found_ua = 0, found_host = 0;
-		    sprintf(request, "GET %s", urls[conn_info[i].url_number].request().c_str());
-		    if (unique) {
-			sprintf(request+strlen(request), "&cnt=%d", conn_info[i].request_number);
-		    }
-		    strcat(request, " HTTP/1.0\r\n");
-		    for (strvec::iterator it = headers.begin(); it != headers.end(); it++) {
-			strcat(request, it->c_str());
-			strcat(request, "\r\n");
-			if (strcasestr(it->c_str(), "host:") != NULL) {
-			    found_host = 1;
-			}
-			if (strcasestr(it->c_str(), "user-agent:") != NULL) {
-			    found_ua = 1;
-			}
-		    }
-		    if (! found_host) {
-			strcat(request, "Host: ");
-			strcat(request, urls[conn_info[i].url_number].host().c_str());
-			strcat(request, "\r\n");
-		    }
-		    if (! found_ua) {
-			strcat(request, "User-Agent: Goofy 0.0\r\n");
-		    }
-		    strcat(request, "\r\n");
-		    if (debug)
-			printf("%s", request);
-
-		    int request_len = strlen(request);
-
-		    // Send the request.
-		    if (write(fds[i].fd, request, request_len) != request_len) {
-			// We can't write the request to the socket, give up.
-			wave_stats.write[errno]++;
-			close_connection(i);
-			if (debug)
-			    printf("fd %d: write err: %d\n", fds[i].fd, err);
-		    }
-		}
-		else {
-		    // Connect failed.
-		    wave_stats.connect[err]++;
-		    close_connection(i);
-		    if (debug)
-			printf("fd %d: connect err: %d\n", fds[i].fd, err);
-		}
+	    else {
+		open_connections(num, current_url, next_wave);
 	    }
+	    period_lag.record(now - next_wave);
+	    if (debug)
+		printf("wave lag: %ld\n", (long) (now - next_wave));
+	    next_wave += wave_interval.get();
+	}
 
-	    // Data available. Read just once so we never block. If there is
-	    // more data, we'll get it next time.
-	    if (fds[i].revents & POLLIN) {
-		fds[i].revents &= ~POLLIN;
-
-		char buf[8192];
-		int n = read(fds[i].fd, buf, sizeof(buf));
-		if (n < 0) {
-		    wave_stats.read[errno]++;
-		    close_connection(i);
-		    if (debug)
-			printf("fd %d read err: %d\n", fds[i].fd, errno);
-		    continue;
-		}
-		else if (n == 0) {
-		    // No data means peer closed the connection.
-		    if (debug)
-			printf("fd %d empty read\n", fds[i].fd);
-		    close_connection(i);
-		}
-		else {
-		    buf[n-1] = 0;
-		    if (debug > 1)
-			printf("fd %d read: %s\n", fds[i].fd, buf);
-		    if (strstr(buf, "HTTP/1.") == buf) {
-			wave_stats.http_code[atoi(buf+9)]++;
-		    }
-		}
+	// Switch to fresh addresses once a re-resolve finishes, and start
+	// the next when it is due.
+	if (resolve_interval > 0) {
+	    const address_table *t = names.finished();
+	    if (t != NULL)
+		current_addresses = t;
+	    if (next_resolve <= now) {
+		names.start();
+		next_resolve = now + resolve_interval;
 	    }
+	}
 
-	    // Peer closed the connection.
-	    if (fds[i].revents & POLLHUP) {
-		fds[i].revents &= ~POLLHUP;
-		if (debug)
-		    printf("fd %d closed\n", fds[i].fd);
-		close_connection(i);
+	if (next_report <= now) {
+	    int64_t began = time_interval::usec();
+	    report_connections(start, wave_interval.get());
+	    report_us = time_interval::usec() - began;
+	    // Skip reports missed entirely rather than print them late.
+	    next_report += report_interval.get();
+	    while (next_report <= now) {
+		next_report += report_interval.get();
+		reports_skipped++;
 	    }
+	}
 
-	    // Anything left in revents is unexpected.
-	    if (fds[i].revents) {
-		printf("fd %d: 0x%x\n", fds[i].fd, fds[i].revents);
-	    }
+	// The reactors do all the I/O; just wait for the next deadline.
+	int64_t deadline = next_report;
+	if ((no_wave_limit || wave_limit > 0) && next_wave < deadline)
+	    deadline = next_wave;
+	if (resolve_interval > 0 && next_resolve < deadline)
+	    deadline = next_resolve;
+	struct itimerspec its;
+	memset(&its, 0, sizeof(its));
+	its.it_value.tv_sec = deadline / 1000000;
+	its.it_value.tv_nsec = deadline % 1000000 * 1000;
+	if (timerfd_settime(timer, TFD_TIMER_ABSTIME, &its, NULL) < 0) {
+	    perror("timerfd_settime");
+	    exit(1);
+	}
+	uint64_t expirations;
+	if (read(timer, &expirations, sizeof(expirations)) < 0 && errno != EINTR) {
+	    perror("read(timerfd)");
+	    exit(1);
 	}
     }
 
+    // Report the last partial period before summing up.
+    report_connections(start, wave_interval.get());
+    report_summary();
+
+    for (size_t i = 0; i < reactors.size(); i++)
+	reactors[i]->stop();
+
     return 0;
 }
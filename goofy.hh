@@ -0,0 +1,323 @@
+#ifndef GOOFY_HH_
+#define GOOFY_HH_
+/*
+ * Declarations shared by the reporting/control code in goofy.cc and
+ * the reactors that own connections.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "url.hh"
+#include "request.hh"
+#include "http.hh"
+#include "histogram.hh"
+#include "trace.hh"
+#include "resolve.hh"
+#include "source.hh"
+#include "tls.hh"
+#include "h2.hh"
+
+typedef std::map<int,int> intmap;
+typedef std::map<int, const char *> strmap;
+typedef std::vector<std::string> strvec;
+typedef std::vector<url> urlvec;
+
+// The latencies measured for each request, in microseconds: connect()
+// to connection, connection to the end of the TLS handshake, request to
+// first response byte, and request to whole response. A connection's
+// first request starts when its wave was due, however late it was
+// launched; later ones when they are sent.
+enum latency_phase { PHASE_CONNECT = 0, PHASE_HANDSHAKE, PHASE_TTFB, PHASE_TOTAL, PHASES };
+
+// Round-trip times sampled from TCP_INFO with -I, in microseconds: the
+// kernel's first estimate, from the SYN and its answer, and its
+// smoothed estimate and variation when the connection closes.
+enum tcp_metric { TCP_SYN_RTT = 0, TCP_RTT, TCP_RTTVAR, TCP_METRICS };
+
+/*
+ * Events counted during one reporting period. Each reactor keeps its
+ * own; the reporter merges them.
+ */
+struct wave_stat {
+    wave_stat() {
+	clear();
+    }
+    void clear() {
+	opened = closed = connected = requests = 0;
+	handshakes = resumed = 0;
+	streams = open_streams = 0;
+	bytes = 0;
+	connecting = established = 0;
+	socket.clear();
+	bind.clear();
+	connect.clear();
+	read.clear();
+	write.clear();
+	http_code.clear();
+	response.clear();
+	tls.clear();
+	timeout.clear();
+	addr_opened.clear();
+	addr_errors.clear();
+	addr_responses.clear();
+	src_opened.clear();
+	src_errors.clear();
+	for (int p = 0; p < PHASES; p++)
+	    latency[p].clear();
+	for (int m = 0; m < TCP_METRICS; m++)
+	    tcp[m].clear();
+	syn_retries.clear();
+	retransmits.clear();
+	lost.clear();
+	launch_us = dispatch_us = busiest_us = 0;
+	syscalls = 0;
+	loop_lag.clear();
+    }
+    // Add the counts in other to this.
+    void merge(const wave_stat &other);
+
+    int opened;
+    int connected;
+    int closed;
+    // Responses completed, and with -2 the HTTP/2 streams opened to
+    // carry requests.
+    int requests;
+    int streams;
+    // TLS handshakes completed, and how many of them resumed a session.
+    int handshakes;
+    int resumed;
+    // Response bytes received, read or discarded.
+    long long bytes;
+    // Connections pending and established at the end of the period.
+    int connecting;
+    int established;
+    // HTTP/2 streams in flight at the end of the period.
+    int open_streams;
+    intmap socket;
+    intmap bind;
+    intmap connect;
+    intmap read;
+    intmap write;
+    intmap http_code;
+    // Responses that could not be used, by http_error.
+    intmap response;
+    // TLS failures, by OpenSSL reason code.
+    intmap tls;
+    // Deadlines missed, by latency_phase.
+    intmap timeout;
+    // Connections opened to, requests failed on, and responses from
+    // each address, by its number.
+    intmap addr_opened;
+    intmap addr_errors;
+    intmap addr_responses;
+    // Connections opened from, and requests failed on, each -s source.
+    intmap src_opened;
+    intmap src_errors;
+    histogram latency[PHASES];
+    // With -I, TCP_INFO round-trip times, and how many connections
+    // retransmitted each number of SYNs, retransmitted each number of
+    // later segments and lost each number of segments.
+    histogram tcp[TCP_METRICS];
+    intmap syn_retries;
+    intmap retransmits;
+    intmap lost;
+    // goofy's own work: microseconds the reactors spent opening waves
+    // and handling events, the most any one reactor spent on both, the
+    // syscalls they made, and how long after each wave was due they
+    // took it up.
+    int64_t launch_us, dispatch_us, busiest_us;
+    long long syscalls;
+    histogram loop_lag;
+};
+
+/*
+ * The rest of goofy's costs over one reporting period, gathered by the
+ * control thread, to tell a generator that cannot keep up from a slow
+ * server.
+ */
+struct self_stat {
+    // The period's length, and the user and system CPU time the whole
+    // process used in it, in microseconds.
+    int64_t period_us, user_us, sys_us;
+    // Time spent writing the previous period's report.
+    int64_t report_us;
+    // Reports missed because the control thread was late.
+    int skipped;
+    // TRUE if waves or reports fell behind -t or -r, or a reactor was
+    // busy nearly all the period.
+    int behind;
+};
+
+class time_interval {
+public:
+    time_interval(const char *_label) : label(_label) {
+	set(0);
+	mark();
+    }
+
+    // Set this.marked to the current time.
+    void mark() {
+	gettod(&marked);
+    }
+
+    // Set this.marked to the given timeval.
+    void mark(struct timeval *t) {
+	memcpy(&marked, t, sizeof(marked));
+    }
+
+    // Set and get the interval used by passed().
+    void set(int _interval) { interval = _interval; }
+    int get() const { return interval; }
+
+    // Return TRUE if now-this.marked exceeds the interval.
+    int passed(struct timeval *now) const {
+	struct timeval delta;
+	timeval_subtract(&delta, now, &marked);
+	//printf("%s: %d, %d, %d, %d, %s\n", label, interval, delta.tv_sec, delta.tv_usec, delta.tv_sec*1000000+delta.tv_usec, delta.tv_sec*1000000+delta.tv_usec > interval ? "true" : "false" );
+	return  ((delta.tv_sec*1000000+delta.tv_usec) > interval);
+    }
+
+    // Fill in out with time elapsed since last mark.
+    void since(struct timeval *out) const {
+	struct timeval now;
+	gettod(&now);
+	timeval_subtract(out, &now, &marked);
+    }
+
+    // STATIC. Return the monotonic clock in microseconds.
+    static int64_t usec() {
+	struct timespec ts;
+	if (clock_gettime(CLOCK_MONOTONIC, &ts) < 0) {
+	    perror("clock_gettime");
+	    exit(1);
+	}
+	return (int64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+    }
+
+    // STATIC. Fill in now with the current time of day.
+    static void gettod(struct timeval *now) {
+	if (gettimeofday(now, NULL) < 0) {
+	    perror("gettimeofday");
+	    exit(1);
+	}
+    }
+
+    // STATIC. Fill in RESULT with X-Y.
+    // Return 1 if the difference is negative, otherwise 0.
+    static int timeval_subtract (struct timeval *result, const struct timeval *x, const struct timeval *y)
+    {
+	struct timeval _y(*y);
+
+	/* Perform the carry for the later subtraction by updating y. */
+	if (x->tv_usec < _y.tv_usec) {
+	    int nsec = (_y.tv_usec - x->tv_usec) / 1000000 + 1;
+	    _y.tv_usec -= 1000000 * nsec;
+	    _y.tv_sec += nsec;
+	}
+	if (x->tv_usec - _y.tv_usec > 1000000) {
+	    int nsec = (x->tv_usec - _y.tv_usec) / 1000000;
+	    _y.tv_usec += 1000000 * nsec;
+	    _y.tv_sec -= nsec;
+	}
+
+	/* Compute the time remaining to wait.
+	   tv_usec is certainly positive. */
+	result->tv_sec = x->tv_sec - _y.tv_sec;
+	result->tv_usec = x->tv_usec - _y.tv_usec;
+
+	/* Return 1 if result is negative. */
+	return x->tv_sec < _y.tv_sec;
+    }
+
+    struct timeval marked, now;
+    int interval;
+    const char *label;
+};
+
+// An https connection is CONN_HANDSHAKE from connect until its TLS
+// handshake ends. A connection is then CONN_WRITING while it sends a
+// request and otherwise CONN_ESTABLISHED until it closes.
+enum conn_state {
+    CONN_UNUSED = 0, CONN_CONNECTING, CONN_HANDSHAKE, CONN_WRITING, CONN_ESTABLISHED,
+    CONN_STATES
+};
+
+// The deepest -k pipeline; each request in flight needs its start time.
+#define PIPELINE_MAX 16
+
+struct conn_info_t {
+    int fd;
+    // The TLS connection on fd, or NULL for plain http.
+    SSL *ssl;
+    // With -2, the HTTP/2 framing for the connection, kept for the
+    // slot's later ones; otherwise NULL.
+    h2_connection *h2;
+    // Requests sent and responses received on this connection.
+    int requests_sent;
+    int responses;
+    http_response response;
+    // The -u counter spliced into the request template, the -C corpus
+    // entry replacing its request line or NULL, and how much of the
+    // request has been sent.
+    char cnt[REQUEST_CNT_MAX];
+    const corpus_entry *entry;
+    int cnt_len;
+    // The request is head_len bytes of headers and then body, if any.
+    int head_len;
+    const request_body *body;
+    int request_len;
+    int request_sent;
+    // The request number of the connection's first request.
+    int request_number;
+    int url_number;
+    // The number of the address connected to, and the -s source
+    // connected from or -1.
+    int address;
+    int source;
+    enum conn_state state;
+    // SYNs retransmitted before it connected, with -I.
+    int syn_retries;
+    // When the connection's wave was due, when connect() was called
+    // and returned, when the TLS handshake ended, when each request in
+    // flight started, and when the current response began to arrive,
+    // all from time_interval::usec().
+    int64_t scheduled;
+    int64_t connecting;
+    int64_t connected;
+    int64_t handshaken;
+    int64_t request_start[PIPELINE_MAX];
+    // The corpus entry each request in flight came from.
+    const corpus_entry *request_entry[PIPELINE_MAX];
+    int64_t first_byte;
+};
+
+extern int debug;
+extern int unique;
+extern int keepalive, requests_per_conn, pipeline_depth;
+extern int discard;
+extern int tcp_sampling;
+extern int h2_streams;
+extern int connect_timeout, ttfb_timeout, total_timeout;
+extern urlvec urls;
+extern std::vector<request_template> templates;
+extern std::vector<h2_request> h2_requests;
+extern strvec headers;
+extern const char *phase_names[PHASES];
+extern const char *tcp_metric_names[TCP_METRICS];
+extern strmap response_errors;
+// The -T trace, or NULL.
+extern trace_file *tracer;
+extern enum tls_resume tls_resumption;
+
+void print_ms(int64_t usec);
+
+#endif /* GOOFY_HH_ */
@@ -0,0 +1,430 @@
+#include "h2.hh"
+#include "goofy.hh"
+#include <ctype.h>
+#include <string.h>
+#include <strings.h>
+
+// Frame types, flags and settings from RFC 9113.
+enum {
+    H2_DATA = 0, H2_HEADERS, H2_PRIORITY, H2_RST_STREAM, H2_SETTINGS,
+    H2_PUSH_PROMISE, H2_PING, H2_GOAWAY, H2_WINDOW_UPDATE, H2_CONTINUATION
+};
+#define H2_END_STREAM 0x1
+#define H2_ACK 0x1
+#define H2_END_HEADERS 0x4
+#define H2_PADDED 0x8
+#define H2_PRIORITY_FLAG 0x20
+#define H2_SETTINGS_ENABLE_PUSH 2
+#define H2_SETTINGS_MAX_CONCURRENT_STREAMS 3
+#define H2_SETTINGS_INITIAL_WINDOW_SIZE 4
+#define H2_REFUSED_STREAM 7
+
+// The largest frame either side may send until told otherwise, and
+// the widest a flow control window may be.
+#define H2_MAX_FRAME 16384
+#define H2_MAX_WINDOW 0x7fffffff
+// Widen a window once this much of it is used.
+#define H2_WINDOW_SLACK (1 << 30)
+
+static uint32_t get32(const char *p) {
+    const uint8_t *u = (const uint8_t *) p;
+    return (uint32_t) u[0] << 24 | u[1] << 16 | u[2] << 8 | u[3];
+}
+
+/*
+ * Append the "Name: value" header at h, len bytes long, to out, with
+ * its name in lower case as HTTP/2 requires. Headers that are about the
+ * HTTP/1 connection are dropped.
+ */
+static void add_header(std::string &out, const char *h, int len) {
+    const char *colon = (const char *) memchr(h, ':', len);
+    if (colon == NULL)
+	return;
+    std::string name(h, colon - h);
+    for (size_t k = 0; k < name.size(); k++)
+	name[k] = tolower(name[k]);
+    const char *value = colon + 1, *end = h + len;
+    while (value < end && isspace(*value))
+	value++;
+    if (name == "connection" || name == "keep-alive" || name == "proxy-connection" ||
+	name == "transfer-encoding" || name == "upgrade" || name == "content-length")
+	return;
+    hpack_literal(out, 0, name.data(), name.size(), value, end - value);
+}
+
+h2_request::h2_request(url &u, const char *m, const std::vector<std::string> &headers) {
+    std::string authority, user_agent = "Goofy 0.0";
+
+    if (strcmp(m, "GET") == 0)
+	hpack_int(method, 7, 0x80, 2);
+    else if (strcmp(m, "POST") == 0)
+	hpack_int(method, 7, 0x80, 3);
+    else
+	hpack_literal(method, 2, NULL, 0, m, strlen(m));
+
+    if (u.host().find(':') != std::string::npos)
+	authority = "[" + u.host() + "]";
+    else
+	authority = u.host();
+    if (u.port() != 80)
+	authority += ":" + std::to_string(u.port());
+    for (size_t i = 0; i < headers.size(); i++) {
+	const char *h = headers[i].c_str(), *value = strchr(h, ':');
+	if (value == NULL)
+	    continue;
+	for (value++; isspace(*value); value++)
+	    ;
+	if (strncasecmp(h, "host:", 5) == 0)
+	    authority = value;
+	else if (strncasecmp(h, "user-agent:", 11) == 0)
+	    user_agent = value;
+	else
+	    add_header(fields, h, headers[i].size());
+    }
+    // :scheme http, then :authority and user-agent by their static
+    // table names.
+    hpack_int(pseudo, 7, 0x80, 6);
+    hpack_literal(pseudo, 1, NULL, 0, authority.data(), authority.size());
+    hpack_literal(fields, 58, NULL, 0, user_agent.data(), user_agent.size());
+    path = u.request();
+}
+
+h2_connection::h2_connection(int max_streams) : streams(max_streams) {
+    reset();
+}
+
+void h2_connection::reset() {
+    for (size_t k = 0; k < streams.size(); k++)
+	streams[k].state = H2_FREE;
+    open = 0;
+    next_id = 1;
+    peer_max = UINT32_MAX;
+    goaway = 0;
+    done.clear();
+    returned = -1;
+    out.clear();
+    out_sent = 0;
+    head_len = 0;
+    headers_id = 0;
+    decoder.reset();
+    unacked = 0;
+}
+
+void h2_connection::start() {
+    static const char preface[] = "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n";
+    // No pushes, and stream windows as wide as they go.
+    static const char settings[] = {
+	0, H2_SETTINGS_ENABLE_PUSH, 0, 0, 0, 0,
+	0, H2_SETTINGS_INITIAL_WINDOW_SIZE, 0x7f, (char) 0xff, (char) 0xff, (char) 0xff,
+    };
+
+    reset();
+    out.append(preface, sizeof(preface) - 1);
+    frame(H2_SETTINGS, 0, 0, settings, sizeof(settings));
+    window_update(0, H2_MAX_WINDOW - 65535);
+}
+
+int h2_connection::can_open() const {
+    return !goaway && open < (int) streams.size() && (uint32_t) open < peer_max &&
+	next_id <= H2_MAX_WINDOW;
+}
+
+void h2_connection::frame(int type, int flags, uint32_t id, const char *payload, int len) {
+    char h[9] = {
+	(char) (len >> 16), (char) (len >> 8), (char) len, (char) type, (char) flags,
+	(char) ((id >> 24) & 0x7f), (char) (id >> 16), (char) (id >> 8), (char) id
+    };
+    out.append(h, sizeof(h));
+    out.append(payload, len);
+}
+
+void h2_connection::window_update(uint32_t id, uint32_t increment) {
+    char p[4] = {
+	(char) (increment >> 24), (char) (increment >> 16), (char) (increment >> 8), (char) increment
+    };
+    frame(H2_WINDOW_UPDATE, 0, id, p, sizeof(p));
+}
+
+h2_stream *h2_connection::open_stream(const h2_request &t, const corpus_entry *e,
+				      const char *cnt, int cnt_len, int number, int64_t start) {
+    const char *path = t.path.data();
+    int path_len = t.path.size();
+
+    block.clear();
+    if (e == NULL) {
+	block += t.method;
+    }
+    else {
+	// "METHOD /path", with one space.
+	const char *sp = (const char *) memchr(e->line, ' ', e->line_len);
+	hpack_literal(block, 2, NULL, 0, e->line, sp - e->line);
+	path = sp + 1;
+	path_len = e->line + e->line_len - path;
+    }
+    block += t.pseudo;
+    hpack_int(block, 4, 0x00, 4);
+    hpack_int(block, 7, 0x00, path_len + cnt_len);
+    block.append(path, path_len);
+    block.append(cnt, cnt_len);
+    block += t.fields;
+    if (e != NULL) {
+	for (const char *h = e->extra, *end = h + e->extra_len; h < end; ) {
+	    const char *crlf = (const char *) memmem(h, end - h, "\r\n", 2);
+	    add_header(block, h, crlf - h);
+	    h = crlf + 2;
+	}
+    }
+
+    int k = 0;
+    while (streams[k].state != H2_FREE)
+	k++;
+    h2_stream *s = &streams[k];
+    s->state = H2_OPEN;
+    s->id = next_id;
+    next_id += 2;
+    s->number = number;
+    s->status = s->error = 0;
+    s->start = start;
+    s->first_byte = 0;
+    s->unacked = 0;
+    open++;
+
+    // A block too big for one frame goes on in CONTINUATIONs.
+    int n = block.size(), len = n < H2_MAX_FRAME ? n : H2_MAX_FRAME;
+    frame(H2_HEADERS, H2_END_STREAM | (len == n ? H2_END_HEADERS : 0), s->id, block.data(), len);
+    for (int off = len; off < n; off += len) {
+	len = n - off < H2_MAX_FRAME ? n - off : H2_MAX_FRAME;
+	frame(H2_CONTINUATION, off + len == n ? H2_END_HEADERS : 0, s->id, block.data() + off, len);
+    }
+    return s;
+}
+
+h2_stream *h2_connection::find(uint32_t id) {
+    for (size_t k = 0; k < streams.size(); k++) {
+	if (streams[k].state == H2_OPEN && streams[k].id == id)
+	    return &streams[k];
+    }
+    return NULL;
+}
+
+void h2_connection::end(h2_stream *s, enum h2_stream_state state) {
+    s->state = state;
+    open--;
+    done.push_back(s - &streams[0]);
+}
+
+h2_stream *h2_connection::ended() {
+    if (returned >= 0) {
+	streams[returned].state = H2_FREE;
+	returned = -1;
+    }
+    if (done.empty())
+	return NULL;
+    returned = done.back();
+    done.pop_back();
+    return &streams[returned];
+}
+
+void h2_connection::written(int n) {
+    out_sent += n;
+    if (out_sent == out.size()) {
+	out.clear();
+	out_sent = 0;
+    }
+}
+
+int h2_connection::feed(const char *buf, int n, int64_t now) {
+    while (1) {
+	if (head_len < (int) sizeof(head)) {
+	    if (n == 0)
+		break;
+	    int take = (int) sizeof(head) - head_len < n ? (int) sizeof(head) - head_len : n;
+	    memcpy(head + head_len, buf, take);
+	    head_len += take;
+	    buf += take;
+	    n -= take;
+	    if (head_len < (int) sizeof(head))
+		break;
+	    length = left = head[0] << 16 | head[1] << 8 | head[2];
+	    type = head[3];
+	    flags = head[4];
+	    id = get32((const char *) head + 5) & 0x7fffffff;
+	    // Nothing may come between a header block's frames.
+	    if (length > H2_MAX_FRAME || (headers_id != 0 && type != H2_CONTINUATION))
+		return 0;
+	    payload.clear();
+	}
+	// DATA is only counted; everything else is kept whole.
+	int take = left < (uint32_t) n ? left : n;
+	if (type != H2_DATA)
+	    payload.append(buf, take);
+	buf += take;
+	n -= take;
+	left -= take;
+	if (left > 0)
+	    break;
+	head_len = 0;
+	if (!frame_done(now))
+	    return 0;
+    }
+    return 1;
+}
+
+/*
+ * A whole frame has arrived. Return FALSE if it breaks the protocol.
+ */
+int h2_connection::frame_done(int64_t now) {
+    h2_stream *s;
+
+    switch (type) {
+    case H2_DATA:
+	unacked += length;
+	if (unacked >= H2_WINDOW_SLACK) {
+	    window_update(0, unacked);
+	    unacked = 0;
+	}
+	s = find(id);
+	if (s == NULL)
+	    break;
+	if (s->first_byte == 0)
+	    s->first_byte = now;
+	if (flags & H2_END_STREAM) {
+	    end(s, H2_DONE);
+	}
+	else if ((s->unacked += length) >= H2_WINDOW_SLACK) {
+	    window_update(s->id, s->unacked);
+	    s->unacked = 0;
+	}
+	break;
+
+    case H2_HEADERS: {
+	const char *p = payload.data();
+	int len = payload.size();
+	if (id == 0)
+	    return 0;
+	if (flags & H2_PADDED) {
+	    if (len < 1 || (uint8_t) p[0] > len - 1)
+		return 0;
+	    len -= 1 + (uint8_t) p[0];
+	    p++;
+	}
+	if (flags & H2_PRIORITY_FLAG) {
+	    if (len < 5)
+		return 0;
+	    p += 5;
+	    len -= 5;
+	}
+	headers.assign(p, len);
+	headers_id = id;
+	headers_end_stream = flags & H2_END_STREAM;
+	if (flags & H2_END_HEADERS)
+	    return headers_done(now);
+	break;
+    }
+
+    case H2_CONTINUATION:
+	if (headers_id == 0 || id != headers_id)
+	    return 0;
+	headers += payload;
+	if (flags & H2_END_HEADERS)
+	    return headers_done(now);
+	break;
+
+    case H2_RST_STREAM:
+	if (length != 4)
+	    return 0;
+	s = find(id);
+	if (s != NULL) {
+	    s->error = get32(payload.data());
+	    end(s, H2_RESET);
+	}
+	break;
+
+    case H2_SETTINGS:
+	if (flags & H2_ACK)
+	    break;
+	if (length % 6 != 0)
+	    return 0;
+	for (uint32_t k = 0; k < length; k += 6) {
+	    int ident = (uint8_t) payload[k] << 8 | (uint8_t) payload[k + 1];
+	    if (ident == H2_SETTINGS_MAX_CONCURRENT_STREAMS)
+		peer_max = get32(payload.data() + k + 2);
+	}
+	frame(H2_SETTINGS, H2_ACK, 0, "", 0);
+	break;
+
+    case H2_PING:
+	if (length != 8)
+	    return 0;
+	if (!(flags & H2_ACK))
+	    frame(H2_PING, H2_ACK, 0, payload.data(), 8);
+	break;
+
+    case H2_GOAWAY: {
+	if (length < 8)
+	    return 0;
+	// Streams after the last the server will process never will be.
+	uint32_t last = get32(payload.data()) & 0x7fffffff;
+	goaway = 1;
+	for (size_t k = 0; k < streams.size(); k++) {
+	    if (streams[k].state == H2_OPEN && streams[k].id > last) {
+		streams[k].error = H2_REFUSED_STREAM;
+		end(&streams[k], H2_RESET);
+	    }
+	}
+	break;
+    }
+
+    case H2_PUSH_PROMISE:
+	// We said no.
+	return 0;
+
+    default:
+	// PRIORITY, WINDOW_UPDATE and unknown types don't concern us.
+	break;
+    }
+    return 1;
+}
+
+/*
+ * A whole header block has arrived. Return FALSE if it is malformed.
+ */
+int h2_connection::headers_done(int64_t now) {
+    uint32_t sid = headers_id;
+    int status = 0;
+
+    headers_id = 0;
+    // Blocks for streams we no longer care about still change the
+    // dynamic table.
+    if (!decoder.decode(headers.data(), headers.size(), &status))
+	return 0;
+    h2_stream *s = find(sid);
+    if (s == NULL)
+	return 1;
+    if (s->first_byte == 0)
+	s->first_byte = now;
+    // Interim 1xx responses come before the final one.
+    if (status > 0 && (s->status == 0 || s->status < 200))
+	s->status = status;
+    if (headers_end_stream)
+	end(s, H2_DONE);
+    return 1;
+}
+
+int64_t h2_connection::deadline(int64_t ttfb, int64_t total, int *phase) const {
+    int64_t when = -1;
+    for (size_t k = 0; k < streams.size(); k++) {
+	const h2_stream &s = streams[k];
+	if (s.state != H2_OPEN)
+	    continue;
+	if (ttfb > 0 && s.first_byte == 0 && (when < 0 || s.start + ttfb < when)) {
+	    when = s.start + ttfb;
+	    *phase = PHASE_TTFB;
+	}
+	if (total > 0 && (when < 0 || s.start + total < when)) {
+	    when = s.start + total;
+	    *phase = PHASE_TOTAL;
+	}
+    }
+    return when;
+}
@@ -0,0 +1,135 @@
+#ifndef H2_HH_
+#define H2_HH_
+/*
+ * HTTP/2 over cleartext TCP with prior knowledge (-2): one client
+ * connection's framing, carrying many requests at once as streams. Like
+ * http_response it does no I/O; the reactor feeds it what it reads and
+ * writes out what it queues. Requests have no bodies, so the server's
+ * flow control windows never matter. Ours start as wide as the protocol
+ * allows and are widened again long before they could close.
+ */
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "url.hh"
+#include "corpus.hh"
+#include "hpack.hh"
+
+// A URL's requests as HPACK header block pieces: the :method, then
+// :scheme and :authority, then the path, spliced in per request with
+// any -u counter, then the regular headers.
+struct h2_request {
+    h2_request(url &u, const char *method, const std::vector<std::string> &headers);
+
+    std::string method, pseudo, path, fields;
+};
+
+enum h2_stream_state { H2_FREE = 0, H2_OPEN, H2_DONE, H2_RESET };
+
+struct h2_stream {
+    enum h2_stream_state state;
+    uint32_t id;
+    // Which of the connection's requests the stream carries, its final
+    // status or 0, and the RST_STREAM error code if it was reset.
+    int number;
+    int status;
+    int error;
+    // When the request started and its response began, from
+    // time_interval::usec(), or 0.
+    int64_t start;
+    int64_t first_byte;
+    // DATA received since the stream's window was last widened.
+    int64_t unacked;
+};
+
+class h2_connection {
+public:
+    // Allow max_streams streams at a time.
+    h2_connection(int max_streams);
+
+    // Forget the connection's streams and output.
+    void reset();
+
+    // Begin a new connection: queue the preface and our settings.
+    void start();
+
+    // TRUE if another stream may be opened now.
+    int can_open() const;
+
+    // Open a stream for request number of the connection, started at
+    // start, rendering it from t, or corpus entry e if not NULL, with
+    // -u counter cnt. Queue its HEADERS.
+    h2_stream *open_stream(const h2_request &t, const corpus_entry *e, const char *cnt,
+			   int cnt_len, int number, int64_t start);
+
+    // Consume n bytes read at now. Return FALSE on a connection error,
+    // after which the connection is useless.
+    int feed(const char *buf, int n, int64_t now);
+
+    // Return a stream that has ended, H2_DONE or H2_RESET, since the
+    // last call, or NULL if there are no more. Each stays valid until
+    // the next call.
+    h2_stream *ended();
+
+    // The bytes queued to be written, and how many of them have been.
+    const char *output() const { return out.data() + out_sent; }
+    int output_len() const { return out.size() - out_sent; }
+    void written(int n);
+
+    int open_streams() const { return open; }
+    int max_streams() const { return streams.size(); }
+    h2_stream &stream(int k) { return streams[k]; }
+
+    // TRUE once the server has sent GOAWAY; no more streams may open.
+    int closing() const { return goaway; }
+
+    // Return the earliest deadline of the open streams, from their
+    // starts: ttfb for those with no response yet, or total; 0 means no
+    // limit. Set *phase to the latency_phase it is for. Return -1 if
+    // there is none.
+    int64_t deadline(int64_t ttfb, int64_t total, int *phase) const;
+
+private:
+    h2_stream *find(uint32_t id);
+    void end(h2_stream *s, enum h2_stream_state state);
+    void frame(int type, int flags, uint32_t id, const char *payload, int len);
+    void window_update(uint32_t id, uint32_t increment);
+    int frame_done(int64_t now);
+    int headers_done(int64_t now);
+
+    std::vector<h2_stream> streams;
+    int open;
+    uint32_t next_id;
+    // The server's SETTINGS_MAX_CONCURRENT_STREAMS, and whether it has
+    // sent GOAWAY.
+    uint32_t peer_max;
+    int goaway;
+    // Streams ended and not yet returned by ended(), and the one last
+    // returned.
+    std::vector<int> done;
+    int returned;
+
+    // Output, and a request's header block as it is built.
+    std::string out;
+    size_t out_sent;
+    std::string block;
+
+    // The frame being read: its header, and for all but DATA its
+    // payload.
+    uint8_t head[9];
+    int head_len;
+    uint32_t length, left;
+    int type, flags;
+    uint32_t id;
+    std::string payload;
+    // A response header block split over CONTINUATION frames, its
+    // stream, and whether it ends the stream.
+    std::string headers;
+    uint32_t headers_id;
+    int headers_end_stream;
+    hpack_decoder decoder;
+    // DATA received since the connection's window was last widened.
+    int64_t unacked;
+};
+
+#endif /* H2_HH_ */
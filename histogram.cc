@@ -0,0 +1,56 @@
+#include "histogram.hh"
+
+/*
+ * Values below sub_buckets map to themselves. A value whose top bit is
+ * e >= sub_bits falls in row e - sub_bits + 1, at the column given by
+ * the sub_bits bits below its top bit.
+ */
+int histogram::bucket(int64_t value) {
+    if (value < sub_buckets)
+	return value;
+    int e = 63 - __builtin_clzll(value);
+    int b = (e - sub_bits + 1) * sub_buckets + (int) ((value >> (e - sub_bits)) - sub_buckets);
+    return b < num_buckets ? b : num_buckets - 1;
+}
+
+/*
+ * The largest value that falls in bucket b.
+ */
+int64_t histogram::bucket_top(int b) {
+    if (b < sub_buckets)
+	return b;
+    int shift = b / sub_buckets - 1;
+    int64_t low = (int64_t) (sub_buckets + b % sub_buckets) << shift;
+    return low + ((int64_t) 1 << shift) - 1;
+}
+
+void histogram::merge(const histogram &other) {
+    if (other.total == 0)
+	return;
+    for (int b = 0; b < num_buckets; b++)
+	counts[b] += other.counts[b];
+    if (total == 0 || other.min_value < min_value)
+	min_value = other.min_value;
+    if (other.max_value > max_value)
+	max_value = other.max_value;
+    total += other.total;
+    sum += other.sum;
+}
+
+int64_t histogram::percentile(double p) const {
+    if (total == 0)
+	return 0;
+    uint64_t want = (uint64_t) (p / 100 * total + 0.5);
+    if (want < 1)
+	want = 1;
+    uint64_t seen = 0;
+    for (int b = 0; b < num_buckets; b++) {
+	seen += counts[b];
+	if (seen >= want) {
+	    // No answer is outside what was actually recorded.
+	    int64_t v = bucket_top(b);
+	    return v < max_value ? (v > min_value ? v : min_value) : max_value;
+	}
+    }
+    return max_value;
+}
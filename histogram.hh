@@ -0,0 +1,66 @@
+#ifndef HISTOGRAM_HH_
+#define HISTOGRAM_HH_
+/*
+ * A log-linear latency histogram in the style of HdrHistogram. Values
+ * (microseconds) below 2^sub_bits get a bucket each; above that, each
+ * power of two is split into 2^sub_bits buckets, so every value is
+ * kept to within about 3% no matter how large. Recording is a few
+ * instructions and merging is a loop over the buckets, so reactors
+ * keep their own and the reporter adds them up.
+ */
+#include <stdint.h>
+#include <string.h>
+
+class histogram {
+public:
+    histogram() { clear(); }
+
+    void clear() {
+	memset(counts, 0, sizeof(counts));
+	total = sum = 0;
+	min_value = max_value = 0;
+    }
+
+    // Count one occurrence of value.
+    void record(int64_t value) {
+	if (value < 0)
+	    value = 0;
+	counts[bucket(value)]++;
+	if (total == 0 || value < min_value)
+	    min_value = value;
+	if (value > max_value)
+	    max_value = value;
+	total++;
+	sum += value;
+    }
+
+    // Add the counts in other to this.
+    void merge(const histogram &other);
+
+    // Return the smallest value that at least p percent of the recorded
+    // values do not exceed, or 0 if nothing was recorded.
+    int64_t percentile(double p) const;
+
+    uint64_t count() const { return total; }
+    int64_t min() const { return min_value; }
+    int64_t max() const { return max_value; }
+    double mean() const { return total ? (double) sum / total : 0; }
+
+private:
+    static const int sub_bits = 5;
+    static const int sub_buckets = 1 << sub_bits;
+    // Values up to 2^max_bits usec (about 19 hours) are kept exactly;
+    // larger ones share the last bucket.
+    static const int max_bits = 36;
+    static const int num_buckets = (max_bits - sub_bits + 1) * sub_buckets;
+
+    static int bucket(int64_t value);
+    static int64_t bucket_top(int b);
+
+    uint64_t counts[num_buckets];
+    uint64_t total;
+    int64_t sum;
+    int64_t min_value, max_value;
+};
+
+#endif /* HISTOGRAM_HH_ */
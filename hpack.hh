@@ -0,0 +1,49 @@
+#ifndef HPACK_HH_
+#define HPACK_HH_
+/*
+ * Just enough HPACK (RFC 7541) for an HTTP/2 client. Requests are
+ * encoded as literals that name static table entries and are never
+ * indexed, so they leave the server's dynamic table alone and a URL's
+ * header block can be built once and sent on any connection. Response
+ * header blocks must be decoded in full to keep our copy of the
+ * server's dynamic table in step, but only :status is kept.
+ */
+#include <stdint.h>
+#include <deque>
+#include <string>
+
+// Append v as an integer with an n-bit prefix, the first byte's higher
+// bits being flags.
+void hpack_int(std::string &out, int n, uint8_t flags, uint64_t v);
+
+// Append a literal header field without indexing, whose name is static
+// table entry index or, if index is 0, name.
+void hpack_literal(std::string &out, int index, const char *name, int name_len,
+                   const char *value, int value_len);
+
+class hpack_decoder {
+public:
+    hpack_decoder() { reset(); }
+
+    // Forget the dynamic table, for a new connection.
+    void reset();
+
+    // Decode the n-byte header block at p, setting *status to its
+    // :status, if it has one. Return FALSE if the block is malformed.
+    int decode(const char *p, int n, int *status);
+
+private:
+    int string(const uint8_t *&p, const uint8_t *end, std::string &out);
+    int lookup(uint64_t index, std::string &name, std::string &value) const;
+    void insert(const std::string &name, const std::string &value);
+    void evict();
+
+    // The dynamic table, newest first, its size as RFC 7541 counts it,
+    // its current limit, and the most the server may raise that to.
+    std::deque<std::pair<std::string, std::string> > table;
+    size_t size, max_size, settings_size;
+    // Each field as it is decoded.
+    std::string name, value;
+};
+
+#endif /* HPACK_HH_ */
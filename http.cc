@@ -0,0 +1,197 @@
+#include "http.hh"
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+void http_response::reset() {
+    state = HTTP_STATUS;
+    code = 0;
+    persistent = false;
+    has_length = false;
+    chunked = false;
+    bodiless = false;
+    body_left = 0;
+    line_len = 0;
+    interim = false;
+}
+
+/*
+ * "HTTP/1.x NNN reason". HTTP/1.1 connections persist unless the
+ * server says otherwise; HTTP/1.0 ones only if it says so.
+ */
+void http_response::status_line() {
+    if (line_len < 12 || strncmp(line, "HTTP/1.", 7) != 0 || line[8] != ' ' ||
+	!isdigit(line[9]) || !isdigit(line[10]) || !isdigit(line[11]) ||
+	(line_len > 12 && line[12] != ' ')) {
+	state = HTTP_BAD;
+	return;
+    }
+    code = atoi(line + 9);
+    persistent = (line[7] != '0');
+    state = HTTP_HEADERS;
+}
+
+void http_response::header_line() {
+    if (strncasecmp(line, "content-length:", 15) == 0) {
+	char *end;
+	has_length = true;
+	body_left = strtoll(line + 15, &end, 10);
+	while (*end == ' ' || *end == '\t')
+	    end++;
+	if (end == line + 15 || *end != 0 || body_left < 0)
+	    state = HTTP_BAD;
+    }
+    else if (strncasecmp(line, "transfer-encoding:", 18) == 0) {
+	if (strcasestr(line + 18, "chunked") != NULL)
+	    chunked = true;
+    }
+    else if (strncasecmp(line, "connection:", 11) == 0) {
+	if (strcasestr(line + 11, "close") != NULL)
+	    persistent = false;
+	else if (strcasestr(line + 11, "keep-alive") != NULL)
+	    persistent = true;
+    }
+}
+
+void http_response::end_of_headers() {
+    if (code >= 100 && code < 200) {
+	// An interim response; the real one follows. The response has
+	// still started, so its first byte is not taken again.
+	bool head = bodiless;
+	reset();
+	bodiless = head;
+	interim = true;
+	return;
+    }
+    if (code == 204 || code == 304 || bodiless) {
+	state = HTTP_DONE;
+    }
+    else if (chunked) {
+	// Chunked encoding overrides any Content-Length.
+	state = HTTP_CHUNK_SIZE;
+    }
+    else if (has_length) {
+	state = (body_left > 0 ? HTTP_BODY : HTTP_DONE);
+    }
+    else {
+	// The body runs until the server closes the connection.
+	persistent = false;
+	state = HTTP_BODY_EOF;
+    }
+}
+
+/*
+ * "HEX[;extension]". A zero size is the last chunk, which trailers
+ * follow.
+ */
+void http_response::chunk_size_line() {
+    char *end;
+    body_left = strtoll(line, &end, 16);
+    while (*end == ' ' || *end == '\t')
+	end++;
+    if (end == line || (*end != 0 && *end != ';') || body_left < 0)
+	state = HTTP_BAD;
+    else if (body_left == 0)
+	state = HTTP_TRAILERS;
+    else
+	state = HTTP_CHUNK_DATA;
+}
+
+int http_response::feed(const char *buf, int n) {
+    int i = 0;
+
+    while (i < n && state != HTTP_DONE && state != HTTP_BAD) {
+	switch (state) {
+	case HTTP_STATUS:
+	case HTTP_HEADERS:
+	case HTTP_CHUNK_SIZE:
+	case HTTP_CHUNK_END:
+	case HTTP_TRAILERS: {
+	    const char *nl = (const char *)memchr(buf + i, '\n', n - i);
+	    int take = (nl != NULL ? nl - (buf + i) : n - i);
+	    int room = sizeof(line) - 1 - line_len;
+	    memcpy(line + line_len, buf + i, take < room ? take : room);
+	    line_len += take < room ? take : room;
+	    i += take;
+	    if (nl == NULL)
+		break;
+
+	    // A complete line.
+	    i++;
+	    if (line_len > 0 && line[line_len-1] == '\r')
+		line_len--;
+	    line[line_len] = 0;
+	    switch (state) {
+	    case HTTP_STATUS:
+		status_line();
+		break;
+	    case HTTP_HEADERS:
+		if (line_len == 0)
+		    end_of_headers();
+		else
+		    header_line();
+		break;
+	    case HTTP_CHUNK_SIZE:
+		chunk_size_line();
+		break;
+	    case HTTP_CHUNK_END:
+		// Chunk data must be followed by an empty line.
+		state = (line_len == 0 ? HTTP_CHUNK_SIZE : HTTP_BAD);
+		break;
+	    case HTTP_TRAILERS:
+		// Trailers are ignored up to the empty line that ends them.
+		if (line_len == 0)
+		    state = HTTP_DONE;
+		break;
+	    default:
+		break;
+	    }
+	    line_len = 0;
+	    break;
+	}
+
+	case HTTP_BODY:
+	case HTTP_CHUNK_DATA: {
+	    int take = (body_left < n - i ? body_left : n - i);
+	    i += take;
+	    body_left -= take;
+	    if (body_left == 0)
+		state = (state == HTTP_BODY ? HTTP_DONE : HTTP_CHUNK_END);
+	    break;
+	}
+
+	case HTTP_BODY_EOF:
+	    i = n;
+	    break;
+
+	case HTTP_DONE:
+	case HTTP_BAD:
+	    break;
+	}
+    }
+    return i;
+}
+
+long long http_response::body_pending() const {
+    if (state == HTTP_BODY || state == HTTP_CHUNK_DATA)
+	return body_left;
+    // Everything until the connection closes.
+    if (state == HTTP_BODY_EOF)
+	return 1LL << 30;
+    return 0;
+}
+
+void http_response::skip(long long n) {
+    if (state == HTTP_BODY_EOF)
+	return;
+    body_left -= n;
+    if (body_left == 0)
+	state = (state == HTTP_BODY ? HTTP_DONE : HTTP_CHUNK_END);
+}
+
+int http_response::eof() {
+    if (state == HTTP_BODY_EOF)
+	state = HTTP_DONE;
+    return done();
+}
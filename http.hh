@@ -0,0 +1,89 @@
+#ifndef HTTP_HH_
+#define HTTP_HH_
+/*
+ * An incremental HTTP/1.x response parser. It is fed whatever each
+ * read returns and keeps just enough state between reads to find the
+ * status and the end of each response, so responses may arrive split
+ * across reads or several to a read. Bodies are framed by
+ * Content-Length, chunked encoding or the end of the connection.
+ */
+
+// Why a response could not be used. HTTP_RESET is an HTTP/2 stream the
+// server reset or refused.
+enum http_error { HTTP_OK = 0, HTTP_MALFORMED, HTTP_TRUNCATED, HTTP_RESET };
+
+class http_response {
+public:
+    http_response() { reset(); }
+
+    // Get ready for the next response on the connection.
+    void reset();
+
+    // The response is to a HEAD request, so has headers only. Call
+    // after reset().
+    void no_body() { bodiless = true; }
+
+    // Consume the first n bytes of buf, stopping at the end of the
+    // response. Return how many bytes were consumed; the rest belong to
+    // the next response. Parsing stops for good if failed().
+    int feed(const char *buf, int n);
+
+    // The peer closed the connection. Return TRUE if that ends the
+    // response, as it does one without a Content-Length.
+    int eof();
+
+    // Return how many of the bytes to come are body the parser need
+    // not see, or 0 if it must see the next ones.
+    long long body_pending() const;
+
+    // The next n bytes, no more than body_pending(), were body and have
+    // been dealt with elsewhere.
+    void skip(long long n);
+
+    // TRUE once the whole response has arrived.
+    int done() const { return state == HTTP_DONE; }
+
+    // TRUE if the response makes no sense as HTTP.
+    int failed() const { return state == HTTP_BAD; }
+
+    // TRUE if any of the response has arrived, counting any 1xx interim
+    // responses before it.
+    int started() const { return state != HTTP_STATUS || line_len > 0 || interim; }
+
+    // The response status, or 0 if the status line was not understood.
+    int status() const { return code; }
+
+    // TRUE if the server will accept another request on the connection.
+    int keep_alive() const { return persistent; }
+
+private:
+    void status_line();
+    void header_line();
+    void end_of_headers();
+    void chunk_size_line();
+
+    enum {
+	HTTP_STATUS = 0, HTTP_HEADERS,
+	HTTP_BODY, HTTP_BODY_EOF,
+	// Chunked bodies: the size line, the data, the CRLF after the
+	// data, and the trailers after the last chunk.
+	HTTP_CHUNK_SIZE, HTTP_CHUNK_DATA, HTTP_CHUNK_END, HTTP_TRAILERS,
+	HTTP_DONE, HTTP_BAD
+    } state;
+    int code;
+    bool persistent;
+    bool has_length;
+    bool chunked;
+    bool bodiless;
+    // A 1xx interim response has been passed over.
+    bool interim;
+    // Bytes left in the body or the current chunk.
+    long long body_left;
+
+    // The start of the current status, header or chunk size line.
+    // Longer lines are truncated; no line we care about needs more.
+    char line[48];
+    unsigned char line_len;
+};
+
+#endif /* HTTP_HH_ */
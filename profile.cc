@@ -0,0 +1,177 @@
+#include "profile.hh"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Segments, one after another:
+ *   const:rate:secs             hold rate
+ *   ramp:from-to:secs           go linearly from one rate to another
+ *   step:r1/r2/...:secs         hold each rate for secs in turn
+ *   sine:mean:amp:period:secs   swing amp either side of mean
+ * and the word "poisson" anywhere makes arrivals Poisson rather than
+ * evenly spaced. Rates are connections per second; times are seconds
+ * and may have fractions.
+ */
+load_profile *load_profile::create(const char *spec, std::string &error) {
+    load_profile *p = new load_profile();
+    std::string text;
+
+    if (spec[0] == '@') {
+	FILE *f = fopen(spec + 1, "r");
+	if (f == NULL) {
+	    perror(spec + 1);
+	    exit(1);
+	}
+	char line[256];
+	while (fgets(line, sizeof(line), f) != NULL) {
+	    char *hash = strchr(line, '#');
+	    if (hash != NULL)
+		*hash = 0;
+	    text += line;
+	    text += ",";
+	}
+	fclose(f);
+    }
+    else {
+	text = spec;
+    }
+
+    // Segments are separated by commas or line ends, padded by blanks.
+    char *s = strdup(text.c_str());
+    for (char *seg = strtok(s, ",\n"); seg != NULL; seg = strtok(NULL, ",\n")) {
+	seg += strspn(seg, " \t\r");
+	char *end = seg + strlen(seg);
+	while (end > seg && strchr(" \t\r", end[-1]) != NULL)
+	    *--end = 0;
+	if (*seg == 0)
+	    continue;
+	if (!p->add_segment(seg, error)) {
+	    free(s);
+	    delete p;
+	    return NULL;
+	}
+    }
+    free(s);
+    if (p->total == 0) {
+	error = "empty load profile";
+	delete p;
+	return NULL;
+    }
+    p->rng.seed(std::random_device()());
+    return p;
+}
+
+/*
+ * Parse one segment and append it.
+ */
+int load_profile::add_segment(const char *spec, std::string &error) {
+    segment s;
+    const char *arg = strchr(spec, ':');
+    std::string name(spec, arg ? arg - spec : strlen(spec));
+    char *end = (char *) (arg ? arg + 1 : "");
+    double secs;
+
+    if (name == "poisson" && arg == NULL) {
+	poisson = true;
+	return 1;
+    }
+
+    s.from = s.to = 0;
+    s.period = 0;
+    if (name == "const") {
+	s.shape = CONSTANT;
+	s.from = strtod(end, &end);
+    }
+    else if (name == "ramp") {
+	s.shape = RAMP;
+	s.from = strtod(end, &end);
+	if (*end++ != '-')
+	    goto bad;
+	s.to = strtod(end, &end);
+    }
+    else if (name == "step") {
+	s.shape = STEP;
+	while (1) {
+	    s.steps.push_back(strtod(end, &end));
+	    if (s.steps.back() < 0)
+		goto bad;
+	    if (*end != '/')
+		break;
+	    end++;
+	}
+    }
+    else if (name == "sine") {
+	s.shape = SINE;
+	s.from = strtod(end, &end);
+	if (*end++ != ':')
+	    goto bad;
+	s.to = strtod(end, &end);
+	if (*end++ != ':')
+	    goto bad;
+	s.period = (int64_t) (strtod(end, &end) * 1000000);
+	if (s.period <= 0)
+	    goto bad;
+    }
+    else {
+	goto bad;
+    }
+    if (*end++ != ':' || s.from < 0 || s.to < 0)
+	goto bad;
+    secs = strtod(end, &end);
+    if (*end != 0 || secs <= 0)
+	goto bad;
+
+    s.length = (int64_t) (secs * 1000000);
+    if (s.shape == STEP)
+	s.length *= s.steps.size();
+    s.start = total;
+    total += s.length;
+    segments.push_back(s);
+    return 1;
+
+  bad:
+    error = std::string("bad load profile segment: ") + spec;
+    return 0;
+}
+
+double load_profile::rate(int64_t t) const {
+    for (size_t i = 0; i < segments.size(); i++) {
+	const segment &s = segments[i];
+	if (t >= s.start + s.length)
+	    continue;
+	if (t < s.start)
+	    return 0;
+	double into = (double) (t - s.start);
+	switch (s.shape) {
+	case CONSTANT:
+	    return s.from;
+	case RAMP:
+	    return s.from + (s.to - s.from) * into / s.length;
+	case STEP:
+	    return s.steps[(size_t) (into * s.steps.size() / s.length)];
+	case SINE: {
+	    double r = s.from + s.to * sin(2 * M_PI * into / s.period);
+	    return r > 0 ? r : 0;
+	}
+	}
+    }
+    return 0;
+}
+
+int load_profile::quota(int64_t t, int64_t tick) {
+    // The rate at the middle of the tick stands for the whole tick.
+    double expected = rate(t + tick / 2) * tick / 1000000.0;
+    if (poisson) {
+	if (expected <= 0)
+	    return 0;
+	std::poisson_distribution<int> arrivals(expected);
+	return arrivals(rng);
+    }
+    // Carry fractions over so low rates still open connections.
+    carry += expected;
+    int n = (int) carry;
+    carry -= n;
+    return n;
+}
@@ -0,0 +1,57 @@
+#ifndef PROFILE_HH_
+#define PROFILE_HH_
+/*
+ * Load profiles (-L). Instead of a fixed -n connections every -t ms, a
+ * profile gives a target rate of new connections per second that
+ * changes over the run: held, ramped, stepped or swung up and down.
+ * The scheduler still ticks every -t ms, and each tick opens however
+ * many connections the rate calls for over that tick, either spread
+ * evenly or, for open-loop arrivals, drawn from a Poisson distribution.
+ */
+#include <stdint.h>
+#include <random>
+#include <string>
+#include <vector>
+
+class load_profile {
+public:
+    // Parse a profile of segments separated by commas, or read one
+    // segment per line from "@file". Return NULL if it makes no sense,
+    // setting error; exit if the file cannot be read.
+    static load_profile *create(const char *spec, std::string &error);
+
+    // How long the profile runs, in microseconds.
+    int64_t duration() const { return total; }
+
+    // The target rate, in connections per second, at t microseconds
+    // into the run.
+    double rate(int64_t t) const;
+
+    // Return how many connections to open for the tick of tick
+    // microseconds starting at t.
+    int quota(int64_t t, int64_t tick);
+
+private:
+    load_profile() : total(0), poisson(false), carry(0) {}
+    int add_segment(const char *spec, std::string &error);
+
+    enum shape { CONSTANT, RAMP, STEP, SINE };
+    struct segment {
+	enum shape shape;
+	int64_t start, length;
+	// CONSTANT: from. RAMP: from to to. STEP: each of steps for
+	// length / steps.size(). SINE: from plus or minus to, repeating
+	// every period.
+	double from, to;
+	std::vector<double> steps;
+	int64_t period;
+    };
+    std::vector<segment> segments;
+    int64_t total;
+    bool poisson;
+    // The fraction of a connection owed from earlier ticks.
+    double carry;
+    std::mt19937_64 rng;
+};
+
+#endif /* PROFILE_HH_ */
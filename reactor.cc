@@ -0,0 +1,1235 @@
+#include "reactor.hh"
+#include <unistd.h>
+#include <errno.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <netinet/tcp.h>
+
+reactor::reactor(int _id, int _reactors, int _slots, const char *engine_name)
+    : id(_id), slots(_slots), free_slots(_slots), open_streams(0), next_source(0),
+      orders_head(0), orders_tail(0), want_epoch(0), have_epoch(0), stopping(false) {
+    engine = event_engine::create(engine_name, slots);
+    if (engine == NULL) {
+	fprintf(stderr, "unknown event engine: %s\n", engine_name);
+	exit(1);
+    }
+    conn_info = new conn_info_t[slots]();
+    memset(live, 0, sizeof(live));
+
+    // Only https URLs need TLS.
+    tls = NULL;
+    for (size_t u = 0; u < urls.size(); u++) {
+	if (urls[u].protocol() == "https" && tls == NULL)
+	    tls = new tls_client(urls.size(), tls_resumption);
+    }
+    live[CONN_UNUSED] = slots;
+
+    // Deadlines, in milliseconds, if there are any.
+    timers = NULL;
+    if (connect_timeout > 0 || ttfb_timeout > 0 || total_timeout > 0)
+	timers = new timer_wheel(slots, time_interval::usec() / 1000);
+
+    // Each reactor binds its own contiguous slice of a -s port range,
+    // so no two ever try the same port. goofy.cc makes sure every
+    // slice holds at least one.
+    rng = ((0x9e3779b97f4a7c15ULL * (id + 1)) ^ time_interval::usec()) | 1;
+    for (size_t s = 0; s < sources.size(); s++) {
+	long long range = sources[s].port_hi - sources[s].port_lo + 1;
+	first_port.push_back(sources[s].port_lo + range * id / _reactors);
+	last_port.push_back(sources[s].port_lo + range * (id + 1) / _reactors - 1);
+	next_port.push_back(first_port[s]);
+    }
+}
+
+void reactor::start() {
+    thread = std::thread(&reactor::run, this);
+}
+
+void reactor::stop() {
+    stopping.store(true);
+    engine->wake();
+    thread.join();
+}
+
+void reactor::order(const wave_order &o) {
+    unsigned tail = orders_tail.load(std::memory_order_relaxed);
+    // A full queue means this reactor is far behind; wait for it.
+    while (tail - orders_head.load(std::memory_order_acquire) >= max_orders) {
+	engine->wake();
+	usleep(1000);
+    }
+    orders[tail % max_orders] = o;
+    orders_tail.store(tail + 1, std::memory_order_release);
+    engine->wake();
+}
+
+void reactor::request_snapshot(unsigned epoch) {
+    want_epoch.store(epoch, std::memory_order_release);
+    engine->wake();
+}
+
+int reactor::snapshot_ready(unsigned epoch) const {
+    return have_epoch.load(std::memory_order_acquire) == epoch;
+}
+
+/**
+ * Open every wave ordered since the last call.
+ */
+void reactor::take_orders() {
+    unsigned head = orders_head.load(std::memory_order_relaxed);
+    unsigned tail = orders_tail.load(std::memory_order_acquire);
+    if (head == tail)
+	return;
+    int64_t now = time_interval::usec();
+    for (; head != tail; head++) {
+	stats.loop_lag.record(now - orders[head % max_orders].start);
+	open_connections(orders[head % max_orders]);
+    }
+    orders_head.store(head, std::memory_order_release);
+    stats.launch_us += time_interval::usec() - now;
+}
+
+/**
+ * Hand the statistics gathered so far to the control thread and start
+ * counting afresh.
+ */
+void reactor::publish() {
+    stats.syscalls += engine->syscalls;
+    engine->syscalls = 0;
+    std::swap(stats, published);
+    stats.clear();
+    published.busiest_us = published.launch_us + published.dispatch_us;
+    published.connecting = live[CONN_CONNECTING];
+    published.established = live[CONN_HANDSHAKE] + live[CONN_WRITING] + live[CONN_ESTABLISHED];
+    published.open_streams = open_streams;
+    have_epoch.store(want_epoch.load(std::memory_order_acquire), std::memory_order_release);
+}
+
+void reactor::run() {
+    const int max_events = 1024;
+    event_t events[max_events];
+
+    while (!stopping.load(std::memory_order_relaxed)) {
+	take_orders();
+	if (want_epoch.load(std::memory_order_acquire) != have_epoch.load(std::memory_order_relaxed))
+	    publish();
+
+	// Wake for the next deadline, if any.
+	int timeout = -1;
+	if (timers != NULL)
+	    timeout = timers->next(time_interval::usec() / 1000);
+	int nfds = engine->wait(events, max_events, timeout);
+	if (nfds < 0) {
+	    if (errno == EINTR)
+		continue;
+	    perror(engine->name());
+	    exit(1);
+	}
+
+	int64_t woke = time_interval::usec();
+	for (int k = 0; k < nfds; ++k) {
+	    if (events[k].op == EV_READY)
+		handle_event(events[k].slot, events[k].revents);
+	    else if (conn_info[events[k].slot].state != CONN_UNUSED)
+		handle_completion(events[k]);
+	}
+
+	// Give up on connections past their deadlines.
+	if (timers != NULL) {
+	    int64_t now = time_interval::usec() / 1000;
+	    int i;
+	    while ((i = timers->expired(now)) >= 0)
+		handle_timeout(i);
+	}
+	stats.dispatch_us += time_interval::usec() - woke;
+    }
+}
+
+/**
+ * Move slot i to state, keeping the live counts and free list current.
+ */
+void reactor::set_state(int i, enum conn_state state) {
+    live[conn_info[i].state]--;
+    live[state]++;
+    conn_info[i].state = state;
+    if (state == CONN_UNUSED)
+	free_slots.put(i);
+}
+
+/**
+ * Initiate this reactor's share of a wave of new non-blocking
+ * connections.
+ */
+void reactor::open_connections(const wave_order &o) {
+    int i, j;
+    int current_url = o.first_url;
+
+    for (i = 0; i < o.num; ++i) {
+	// Reserve a free slot.
+	if (free_slots.available() == 0) {
+	    fprintf(stderr, "out of fds\n");
+	    exit(1);
+	}
+
+	// Select the next URL, and take its addresses in turn.
+	int request_number = o.first_request + i * requests_per_conn;
+	int url_number = current_url;
+	const std::vector<int> &url_addresses = o.addresses->by_url[url_number];
+	int a = url_addresses[(request_number / requests_per_conn / urls.size()) %
+			      url_addresses.size()];
+	const address *addr = &addresses[a];
+	current_url = (current_url + 1) % urls.size();
+
+	// Create the socket. Sockets stay non-blocking for their whole
+	// life unless the engine does the I/O.
+	int fd = socket(addr->sa.ss_family, SOCK_STREAM | (engine->completions() ? 0 : SOCK_NONBLOCK), 0);
+	stats.syscalls++;
+	if (fd < 0) {
+	    stats.socket[errno]++;
+	    account_open_failure(request_number, url_number, a, -1, o.start, TRACE_SOCKET, errno);
+	    continue;
+	}
+
+	// Bind the next -s source address, if any.
+	int src = -1;
+	int err = bind_source(fd, addr->sa.ss_family, &src);
+	if (err != 0) {
+	    stats.bind[err]++;
+	    account_open_failure(request_number, url_number, a, src, o.start, TRACE_BIND, err);
+	    close(fd);
+	    stats.syscalls++;
+	    continue;
+	}
+
+	j = free_slots.get();
+	conn_info[j].url_number = url_number;
+	conn_info[j].address = a;
+	conn_info[j].source = src;
+	stats.addr_opened[a]++;
+	if (src >= 0)
+	    stats.src_opened[src]++;
+
+	if (engine->completions()) {
+	    // The engine connects asynchronously on our behalf.
+	    engine->connect(j, fd, (const struct sockaddr *) &addr->sa, addr->len);
+	}
+	else {
+	    // Use non-blocking connects which correctly fail with EINPROGRESS.
+	    stats.syscalls++;
+	    if (! (connect(fd, (const struct sockaddr *) &addr->sa, addr->len)<0
+		   && errno == EINPROGRESS)) {
+		stats.connect[errno]++;
+		account_open_failure(request_number, url_number, a, src, o.start, TRACE_CONNECT, errno);
+		close(fd);
+		stats.syscalls++;
+		free_slots.put(j);
+		continue;
+	    }
+
+	    // Request POLLOUT so we are informed on connect.
+	    engine->add(j, fd, POLLIN|POLLOUT);
+	}
+
+	// Record the socket.
+	conn_info[j].fd = fd;
+	set_state(j, CONN_CONNECTING);
+	conn_info[j].request_number = request_number;
+	conn_info[j].scheduled = o.start;
+	conn_info[j].connecting = time_interval::usec();
+	conn_info[j].connected = 0;
+	conn_info[j].handshaken = 0;
+	conn_info[j].syn_retries = 0;
+	arm_timer(j);
+	stats.opened++;
+
+	if (debug)
+	    printf("open: fds %d, fd %d\n", j, fd);
+    }
+
+    // Launch the whole wave at once.
+    engine->flush();
+}
+
+/**
+ * Bind fd, a socket of family, to the next -s source of that family
+ * and set *src to its index. Leave fd alone and set *src to -1 if
+ * there are no sources. Return 0 or an errno.
+ */
+int reactor::bind_source(int fd, int family, int *src) {
+    *src = -1;
+    if (sources.empty())
+	return 0;
+
+    // Take the sources in turn, skipping those of the wrong family.
+    for (size_t k = 0; k < sources.size() && *src < 0; k++) {
+	int s = next_source;
+	next_source = (next_source + 1) % sources.size();
+	if (sources[s].sa.ss_family == family)
+	    *src = s;
+    }
+    if (*src < 0)
+	return EAFNOSUPPORT;
+
+    source *s = &sources[*src];
+    struct sockaddr_storage sa = s->sa;
+    int one = 1;
+    if (s->port_lo == 0) {
+	// Choose the port at connect(), when the whole 4-tuple is known,
+	// so it need only be unique per destination.
+	stats.syscalls++;
+	if (setsockopt(fd, IPPROTO_IP, IP_BIND_ADDRESS_NO_PORT, &one, sizeof(one)) < 0)
+	    return errno;
+    }
+    else {
+	// Ports in TIME_WAIT may be bound again.
+	stats.syscalls++;
+	if (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) < 0)
+	    return errno;
+	int port = next_port[*src];
+	next_port[*src] = (port < last_port[*src] ? port + 1 : first_port[*src]);
+	if (sa.ss_family == AF_INET6)
+	    ((struct sockaddr_in6 *) &sa)->sin6_port = htons(port);
+	else
+	    ((struct sockaddr_in *) &sa)->sin_port = htons(port);
+    }
+    stats.syscalls++;
+    if (bind(fd, (struct sockaddr *) &sa, s->len) < 0)
+	return errno;
+    return 0;
+}
+
+/**
+ * With -I, sample slot i's TCP_INFO. While it is connecting, which it
+ * still is when a connect succeeds or fails, every retransmission so
+ * far was of the SYN; once it has connected, sample the round-trip time
+ * and the retransmissions and losses since.
+ */
+void reactor::sample_tcp(int i) {
+    conn_info_t *c = &conn_info[i];
+    struct tcp_info ti;
+    socklen_t len = sizeof(ti);
+
+    if (!tcp_sampling)
+	return;
+    stats.syscalls++;
+    if (getsockopt(c->fd, IPPROTO_TCP, TCP_INFO, &ti, &len) < 0)
+	return;
+    if (c->state == CONN_CONNECTING) {
+	c->syn_retries = ti.tcpi_total_retrans;
+	stats.syn_retries[c->syn_retries]++;
+	if (c->connected != 0)
+	    stats.tcp[TCP_SYN_RTT].record(ti.tcpi_rtt);
+    }
+    else {
+	stats.tcp[TCP_RTT].record(ti.tcpi_rtt);
+	stats.tcp[TCP_RTTVAR].record(ti.tcpi_rttvar);
+	stats.retransmits[ti.tcpi_total_retrans - c->syn_retries]++;
+	stats.lost[ti.tcpi_lost]++;
+    }
+}
+
+/**
+ * Clean up a connection slot.
+ */
+void reactor::close_connection(int i) {
+    sample_tcp(i);
+    if (conn_info[i].ssl != NULL) {
+	// Closing without a close_notify would make OpenSSL forget the
+	// session; we want to resume it.
+	SSL_set_shutdown(conn_info[i].ssl, SSL_SENT_SHUTDOWN);
+	SSL_free(conn_info[i].ssl);
+	conn_info[i].ssl = NULL;
+    }
+    if (conn_info[i].h2 != NULL) {
+	open_streams -= conn_info[i].h2->open_streams();
+	conn_info[i].h2->reset();
+    }
+    if (timers != NULL)
+	timers->cancel(i);
+    engine->remove(i, conn_info[i].fd);
+    close(conn_info[i].fd);
+    stats.syscalls++;
+    stats.closed++;
+    conn_info[i].fd = -1;
+    set_state(i, CONN_UNUSED);
+}
+
+/**
+ * Set slot i's deadline for what it is waiting on, or clear it if that
+ * has no limit. Requests are timed like their latencies, so a
+ * connection's first request from when its wave was due.
+ */
+void reactor::arm_timer(int i) {
+    if (timers == NULL)
+	return;
+    conn_info_t *c = &conn_info[i];
+    int64_t deadline = -1;
+
+    if (c->state == CONN_CONNECTING || c->state == CONN_HANDSHAKE) {
+	if (connect_timeout > 0)
+	    deadline = c->connecting + connect_timeout * 1000LL;
+    }
+    else if (c->h2 != NULL) {
+	// Streams are timed each on its own; the first to run out closes
+	// the connection.
+	int phase;
+	deadline = c->h2->deadline(ttfb_timeout * 1000LL, total_timeout * 1000LL, &phase);
+    }
+    else if (c->requests_sent > c->responses) {
+	// The oldest request in flight; the others wait their turn.
+	int64_t start = c->request_start[c->responses % PIPELINE_MAX];
+	if (ttfb_timeout > 0 && !c->response.started())
+	    deadline = start + ttfb_timeout * 1000LL;
+	if (total_timeout > 0 && (deadline < 0 || start + total_timeout * 1000LL < deadline))
+	    deadline = start + total_timeout * 1000LL;
+    }
+    if (deadline < 0)
+	timers->cancel(i);
+    else
+	timers->schedule(i, (deadline + 999) / 1000);
+}
+
+/**
+ * Slot i missed its deadline; count it against the phase it was in and
+ * close the connection.
+ */
+void reactor::handle_timeout(int i) {
+    conn_info_t *c = &conn_info[i];
+    int phase;
+
+    if (c->state == CONN_CONNECTING)
+	phase = PHASE_CONNECT;
+    else if (c->state == CONN_HANDSHAKE)
+	phase = PHASE_HANDSHAKE;
+    else if (c->h2 != NULL) {
+	phase = PHASE_TOTAL;
+	c->h2->deadline(ttfb_timeout * 1000LL, total_timeout * 1000LL, &phase);
+    }
+    else if (!c->response.started() && ttfb_timeout > 0 &&
+	     (total_timeout == 0 || ttfb_timeout <= total_timeout))
+	phase = PHASE_TTFB;
+    else
+	phase = PHASE_TOTAL;
+    stats.timeout[phase] += in_flight(i);
+    account(i, TRACE_TIMEOUT, phase);
+    if (debug)
+	printf("fd %d: %s timeout\n", c->fd, phase_names[phase]);
+    close_connection(i);
+}
+
+/**
+ * Get the socket error for a connection slot.
+ */
+int reactor::get_sock_error(int i) {
+    int optval;
+    socklen_t optlen;
+    optlen = sizeof(optval);
+    stats.syscalls++;
+    if (getsockopt(conn_info[i].fd, SOL_SOCKET, SO_ERROR, &optval, &optlen)< 0) {
+	perror("getsockopt(SO_ERROR, SOL_SOCKET");
+	exit(1);
+    }
+    return optval;
+}
+
+/**
+ * Return how many requests a failure of slot i's connection ends, as
+ * account() counts them: every open stream on an HTTP/2 connection,
+ * otherwise every request sent and not yet answered, or one if there
+ * are none.
+ */
+int reactor::in_flight(int i) {
+    conn_info_t *c = &conn_info[i];
+    if (c->h2 != NULL)
+	return (c->h2->open_streams() > 0 ? c->h2->open_streams() : 1);
+    return (c->requests_sent > c->responses ? c->requests_sent - c->responses : 1);
+}
+
+/**
+ * Account for how slot i's oldest unanswered request, or the
+ * connection if it has sent none, ended: against its address, and in
+ * the trace. A failure ends every request in flight: on an HTTP/1
+ * connection each one pipelined behind the oldest, and on an HTTP/2
+ * connection each open stream unless s names the one.
+ */
+void reactor::account(int i, enum trace_kind kind, int err, const h2_stream *s) {
+    conn_info_t *c = &conn_info[i];
+    if (c->h2 != NULL && s == NULL && c->h2->open_streams() > 0) {
+	for (int k = 0; k < c->h2->max_streams(); k++) {
+	    if (c->h2->stream(k).state == H2_OPEN)
+		account(i, kind, err, &c->h2->stream(k));
+	}
+	return;
+    }
+    int n = (s == NULL && kind != TRACE_OK ? in_flight(i) : 1);
+    if (kind == TRACE_OK) {
+	stats.addr_responses[c->address]++;
+    }
+    else {
+	stats.addr_errors[c->address] += n;
+	if (c->source >= 0)
+	    stats.src_errors[c->source] += n;
+    }
+    if (tracer == NULL)
+	return;
+
+    trace_record r;
+    memset(&r, 0, sizeof(r));
+    r.url_number = c->url_number;
+    r.reactor = id;
+    r.kind = kind;
+    r.err = err;
+    r.connecting = c->connecting;
+    r.connected = c->connected;
+    r.handshaken = c->handshaken;
+    r.done = time_interval::usec();
+    if (s != NULL) {
+	r.request_number = c->request_number + s->number;
+	r.status = s->status;
+	if (s->number == 0)
+	    r.flags |= TRACE_FIRST;
+	r.scheduled = s->start;
+	r.first_byte = s->first_byte;
+	tracer->append(r);
+	return;
+    }
+    for (int k = 0; k < n; k++) {
+	int number = c->responses + k;
+	r.request_number = c->request_number + number;
+	r.flags = (number == 0 ? TRACE_FIRST : 0);
+	r.scheduled = (number < c->requests_sent ?
+		       c->request_start[number % PIPELINE_MAX] : c->scheduled);
+	// Only the oldest can have begun its response.
+	if (k == 0) {
+	    r.status = c->response.status();
+	    r.first_byte = c->response.started() ? c->first_byte : 0;
+	}
+	else {
+	    r.status = 0;
+	    r.first_byte = 0;
+	}
+	tracer->append(r);
+    }
+}
+
+/**
+ * Account for a request whose connection could not be opened.
+ */
+void reactor::account_open_failure(int request_number, int url_number, int address,
+				   int src, int64_t scheduled, enum trace_kind kind, int err) {
+    stats.addr_errors[address]++;
+    if (src >= 0)
+	stats.src_errors[src]++;
+    if (tracer == NULL)
+	return;
+
+    trace_record r;
+    memset(&r, 0, sizeof(r));
+    r.request_number = request_number;
+    r.url_number = url_number;
+    r.reactor = id;
+    r.kind = kind;
+    r.flags = TRACE_FIRST;
+    r.err = err;
+    r.scheduled = scheduled;
+    r.connecting = r.done = time_interval::usec();
+    tracer->append(r);
+}
+
+/**
+ * A non-blocking connect on slot i finished with error err, or 0 if
+ * it succeeded. On success, send the request.
+ */
+void reactor::handle_connect(int i, int err) {
+    if (err != 0) {
+	// Connect failed.
+	stats.connect[err] += in_flight(i);
+	account(i, TRACE_CONNECT, err);
+	if (debug)
+	    printf("fd %d: connect err: %d\n", conn_info[i].fd, err);
+	close_connection(i);
+	return;
+    }
+
+    // Connect succeeded.
+    stats.connected++;
+    conn_info[i].connected = time_interval::usec();
+    sample_tcp(i);
+    if (debug)
+	printf("fd %d: connect\n", conn_info[i].fd);
+
+    int64_t delta = conn_info[i].connected - conn_info[i].connecting;
+    stats.latency[PHASE_CONNECT].record(delta);
+    if (debug && delta > 1000000) {
+	printf("%d connect time: %ld\n", conn_info[i].request_number, (long) delta);
+    }
+
+    if (urls[conn_info[i].url_number].protocol() == "https") {
+	start_handshake(i);
+	return;
+    }
+    connection_ready(i);
+}
+
+/**
+ * Begin a TLS handshake on slot i's new connection.
+ */
+void reactor::start_handshake(int i) {
+    conn_info_t *c = &conn_info[i];
+    c->ssl = tls->connect(c->fd, urls[c->url_number].host().c_str(), c->url_number);
+    set_state(i, CONN_HANDSHAKE);
+    continue_handshake(i);
+}
+
+/**
+ * Take slot i's TLS handshake as far as the socket allows, and start
+ * sending requests once it is done.
+ */
+void reactor::continue_handshake(int i) {
+    conn_info_t *c = &conn_info[i];
+    errno = 0;
+    int r = SSL_do_handshake(c->ssl);
+    stats.syscalls++;
+    if (r != 1) {
+	int err = SSL_get_error(c->ssl, r);
+	if (err == SSL_ERROR_WANT_READ) {
+	    engine->modify(i, c->fd, POLLIN);
+	    return;
+	}
+	if (err == SSL_ERROR_WANT_WRITE) {
+	    engine->modify(i, c->fd, POLLIN|POLLOUT);
+	    return;
+	}
+	tls_failed(i, err, TRACE_READ);
+	return;
+    }
+
+    c->handshaken = time_interval::usec();
+    stats.latency[PHASE_HANDSHAKE].record(c->handshaken - c->connected);
+    stats.handshakes++;
+    if (SSL_session_reused(c->ssl))
+	stats.resumed++;
+    if (debug)
+	printf("fd %d: %s handshake%s\n", c->fd, SSL_get_version(c->ssl),
+	       SSL_session_reused(c->ssl) ? ", resumed" : "");
+    connection_ready(i);
+}
+
+/**
+ * A TLS call on slot i failed with SSL_get_error() code err. Count the
+ * failure as kind if it was the socket's fault and as a TLS error
+ * otherwise, and close the connection.
+ */
+void reactor::tls_failed(int i, int err, enum trace_kind kind) {
+    int reason = tls_client::error_reason();
+    if (err == SSL_ERROR_SYSCALL && reason == 0 && errno != 0) {
+	int e = errno;
+	if (kind == TRACE_WRITE)
+	    stats.write[e] += in_flight(i);
+	else
+	    stats.read[e] += in_flight(i);
+	account(i, kind, e);
+    }
+    else {
+	stats.tls[reason] += in_flight(i);
+	account(i, TRACE_TLS, reason);
+    }
+    if (debug)
+	printf("fd %d: tls error %d: %s\n", conn_info[i].fd, err,
+	       tls_client::reason_string(reason));
+    close_connection(i);
+}
+
+/**
+ * Slot i's connection is ready for requests; send the first.
+ */
+void reactor::connection_ready(int i) {
+    conn_info_t *c = &conn_info[i];
+    c->requests_sent = c->responses = 0;
+    if (h2_streams > 0) {
+	// The preface goes out with the first requests.
+	if (c->h2 == NULL)
+	    c->h2 = new h2_connection(h2_streams);
+	c->h2->start();
+	set_state(i, CONN_WRITING);
+	h2_send(i);
+	return;
+    }
+    // Engines that read for us listen for the whole connection.
+    set_state(i, CONN_ESTABLISHED);
+    c->response.reset();
+    if (engine->completions())
+	engine->read(i, c->fd);
+    send_next(i);
+}
+
+/**
+ * Prepare slot i's next request if the connection may carry another
+ * and the pipeline has room. Return TRUE if there is one to send.
+ */
+int reactor::begin_request(int i) {
+    conn_info_t *c = &conn_info[i];
+    if (c->state != CONN_ESTABLISHED ||
+	c->requests_sent >= requests_per_conn ||
+	c->requests_sent - c->responses >= pipeline_depth)
+	return 0;
+
+    // Fill in the request from its URL's template, and the corpus if
+    // there is one.
+    const request_template &t = templates[c->url_number];
+    int number = c->request_number + c->requests_sent;
+    c->entry = corpus ? &corpus->entry(corpus->pick(random())) : NULL;
+    c->cnt_len = unique ? request_cnt(number, c->cnt) : 0;
+    c->head_len = request_length(t, c->entry, c->cnt_len);
+    c->body = request_body_of(t, c->entry);
+    c->request_len = c->head_len + (c->body ? c->body->len : 0);
+    c->request_sent = 0;
+    c->request_entry[c->requests_sent % PIPELINE_MAX] = c->entry;
+    // The response to this request is the next one due.
+    if (c->requests_sent == c->responses && (c->entry ? c->entry->head : t.head_only))
+	c->response.no_body();
+    // The first request's time includes the connect and any delay in
+    // launching its wave.
+    c->request_start[c->requests_sent % PIPELINE_MAX] =
+	c->requests_sent == 0 ? c->scheduled : time_interval::usec();
+    c->requests_sent++;
+    set_state(i, CONN_WRITING);
+    arm_timer(i);
+    engine->modify(i, c->fd, POLLIN|POLLOUT);
+    if (debug) {
+	struct iovec iov[REQUEST_IOV_MAX];
+	int iovcnt = request_iov(t, c->entry, c->cnt, c->cnt_len, 0, iov, 0);
+	for (int k = 0; k < iovcnt; k++)
+	    printf("%.*s", (int) iov[k].iov_len, (char *) iov[k].iov_base);
+    }
+    return 1;
+}
+
+/**
+ * Send slot i's next request, if it has one. Return FALSE if the
+ * connection was closed.
+ */
+int reactor::send_next(int i) {
+    if (!begin_request(i))
+	return 1;
+    if (engine->completions()) {
+	conn_info_t *c = &conn_info[i];
+	struct iovec iov[REQUEST_IOV_MAX];
+	int iovcnt = request_iov(templates[c->url_number], c->entry, c->cnt, c->cnt_len, 0,
+				 iov, 1);
+	engine->write(i, c->fd, iov, iovcnt);
+	return 1;
+    }
+    return write_request(i);
+}
+
+/**
+ * Send what remains of slot i's request without blocking. Return FALSE
+ * if the connection was closed.
+ */
+int reactor::write_request(int i) {
+    conn_info_t *c = &conn_info[i];
+
+  again:
+    while (c->request_sent < c->request_len) {
+	struct iovec iov[REQUEST_IOV_MAX];
+	int n;
+	if (c->ssl != NULL) {
+	    // TLS records are written a piece at a time, the body from its
+	    // mapping. A retry after WANT_* passes the same piece again, as
+	    // OpenSSL requires.
+	    request_iov(templates[c->url_number], c->entry, c->cnt, c->cnt_len,
+			c->request_sent, iov, 1);
+	    errno = 0;
+	    n = SSL_write(c->ssl, iov[0].iov_base, iov[0].iov_len);
+	    stats.syscalls++;
+	    if (n <= 0) {
+		int err = SSL_get_error(c->ssl, n);
+		if (err == SSL_ERROR_WANT_READ || err == SSL_ERROR_WANT_WRITE)
+		    return 1;
+		tls_failed(i, err, TRACE_WRITE);
+		return 0;
+	    }
+	    c->request_sent += n;
+	    continue;
+	}
+	if (c->request_sent >= c->head_len) {
+	    // The body goes from the page cache to the socket without
+	    // passing through us.
+	    off_t off = c->request_sent - c->head_len;
+	    n = sendfile(c->fd, c->body->fd, &off, c->request_len - c->request_sent);
+	    stats.syscalls++;
+	    if (n == 0) {
+		// The file shrank under us.
+		errno = EIO;
+		n = -1;
+	    }
+	}
+	else {
+	    // sendmsg() is writev() without SIGPIPE. MSG_MORE lets the
+	    // headers share packets with the body.
+	    struct msghdr msg;
+	    memset(&msg, 0, sizeof(msg));
+	    msg.msg_iov = iov;
+	    msg.msg_iovlen = request_iov(templates[c->url_number], c->entry, c->cnt,
+					 c->cnt_len, c->request_sent, iov, 0);
+	    n = sendmsg(c->fd, &msg, MSG_NOSIGNAL | (c->body ? MSG_MORE : 0));
+	    stats.syscalls++;
+	}
+	if (n < 0) {
+	    if (errno == EINTR)
+		continue;
+	    // Resume when the socket is writable again.
+	    if (errno == EAGAIN || errno == EWOULDBLOCK)
+		return 1;
+	    stats.write[errno] += in_flight(i);
+	    account(i, TRACE_WRITE, errno);
+	    if (debug)
+		printf("fd %d: write err: %d\n", c->fd, errno);
+	    close_connection(i);
+	    return 0;
+	}
+	c->request_sent += n;
+    }
+    // Pipeline the next request right behind this one.
+    if (request_written(i))
+	goto again;
+    return 1;
+}
+
+/**
+ * Slot i has sent its whole request; wait for the response. Return
+ * TRUE if another request is ready to go out behind it.
+ */
+int reactor::request_written(int i) {
+    engine->modify(i, conn_info[i].fd, POLLIN);
+    set_state(i, CONN_ESTABLISHED);
+    return begin_request(i);
+}
+
+/**
+ * Open as many streams on slot i's HTTP/2 connection as it may carry
+ * and the server allows, then send them with whatever else is queued.
+ * Return FALSE if the connection was closed.
+ */
+int reactor::h2_send(int i) {
+    conn_info_t *c = &conn_info[i];
+    int64_t now = 0;
+
+    while (c->requests_sent < requests_per_conn && c->h2->can_open()) {
+	const corpus_entry *e = corpus ? &corpus->entry(corpus->pick(random())) : NULL;
+	int cnt_len = unique ? request_cnt(c->request_number + c->requests_sent, c->cnt) : 0;
+	// As over HTTP/1, the first request's time includes the connect
+	// and any delay in launching its wave.
+	int64_t start = c->scheduled;
+	if (c->requests_sent > 0) {
+	    if (now == 0)
+		now = time_interval::usec();
+	    start = now;
+	}
+	c->h2->open_stream(h2_requests[c->url_number], e, c->cnt, cnt_len, c->requests_sent, start);
+	c->requests_sent++;
+	stats.streams++;
+	open_streams++;
+    }
+    arm_timer(i);
+    return h2_flush(i);
+}
+
+/**
+ * Write what slot i's HTTP/2 connection has queued without blocking,
+ * waiting for room if the socket fills. Return FALSE if the connection
+ * was closed.
+ */
+int reactor::h2_flush(int i) {
+    conn_info_t *c = &conn_info[i];
+
+    while (c->h2->output_len() > 0) {
+	int n = send(c->fd, c->h2->output(), c->h2->output_len(), MSG_NOSIGNAL);
+	stats.syscalls++;
+	if (n < 0) {
+	    if (errno == EINTR)
+		continue;
+	    if (errno == EAGAIN || errno == EWOULDBLOCK) {
+		if (c->state != CONN_WRITING) {
+		    set_state(i, CONN_WRITING);
+		    engine->modify(i, c->fd, POLLIN|POLLOUT);
+		}
+		return 1;
+	    }
+	    stats.write[errno] += in_flight(i);
+	    account(i, TRACE_WRITE, errno);
+	    if (debug)
+		printf("fd %d: write err: %d\n", c->fd, errno);
+	    close_connection(i);
+	    return 0;
+	}
+	c->h2->written(n);
+    }
+    if (c->state != CONN_ESTABLISHED) {
+	set_state(i, CONN_ESTABLISHED);
+	engine->modify(i, c->fd, POLLIN);
+    }
+    return 1;
+}
+
+/**
+ * Process n bytes read from slot i's HTTP/2 connection: account for
+ * the streams they end and open more in their place. Return FALSE if
+ * the connection was closed.
+ */
+int reactor::h2_data(int i, char *buf, int n) {
+    conn_info_t *c = &conn_info[i];
+    int64_t now = time_interval::usec();
+
+    if (!c->h2->feed(buf, n, now)) {
+	stats.response[HTTP_MALFORMED] += in_flight(i);
+	account(i, TRACE_RESPONSE, HTTP_MALFORMED);
+	if (debug)
+	    printf("fd %d: http/2 protocol error\n", c->fd);
+	close_connection(i);
+	return 0;
+    }
+    h2_stream *s;
+    while ((s = c->h2->ended()) != NULL) {
+	open_streams--;
+	c->responses++;
+	if (s->state == H2_RESET) {
+	    stats.response[HTTP_RESET]++;
+	    account(i, TRACE_RESPONSE, HTTP_RESET, s);
+	    if (debug)
+		printf("fd %d: stream %u reset: %d\n", c->fd, s->id, s->error);
+	    continue;
+	}
+	if (s->status > 0)
+	    stats.http_code[s->status]++;
+	stats.requests++;
+	stats.latency[PHASE_TTFB].record(s->first_byte - s->start);
+	stats.latency[PHASE_TOTAL].record(now - s->start);
+	account(i, TRACE_OK, 0, s);
+    }
+
+    // Once the last stream ends the connection is done with, as one
+    // without keep-alive is after its response.
+    if (c->responses >= requests_per_conn || (c->h2->closing() && c->h2->open_streams() == 0)) {
+	close_connection(i);
+	return 0;
+    }
+    return h2_send(i);
+}
+
+/**
+ * Process n bytes of response read from slot i. Return FALSE if the
+ * connection was closed.
+ */
+int reactor::handle_data(int i, char *buf, int n) {
+    conn_info_t *c = &conn_info[i];
+    int64_t now = time_interval::usec();
+
+    stats.bytes += n;
+    if (debug > 1)
+	printf("fd %d read: %.*s\n", c->fd, n, buf);
+    if (c->h2 != NULL)
+	return h2_data(i, buf, n);
+    while (n > 0) {
+	if (!c->response.started())
+	    c->first_byte = now;
+	int used = c->response.feed(buf, n);
+	buf += used;
+	n -= used;
+	if (c->response.failed()) {
+	    stats.response[HTTP_MALFORMED] += in_flight(i);
+	    account(i, TRACE_RESPONSE, HTTP_MALFORMED);
+	    if (debug)
+		printf("fd %d: malformed response\n", c->fd);
+	    close_connection(i);
+	    return 0;
+	}
+	if (c->response.done() && !response_done(i))
+	    return 0;
+    }
+    // A first byte trades the first-byte deadline for the total one.
+    if (ttfb_timeout > 0)
+	arm_timer(i);
+    return 1;
+}
+
+/**
+ * n bytes of slot i's response body were discarded unread. Return
+ * FALSE if the connection was closed.
+ */
+int reactor::handle_discarded(int i, int n) {
+    conn_info_t *c = &conn_info[i];
+
+    stats.bytes += n;
+    if (debug > 1)
+	printf("fd %d discarded %d\n", c->fd, n);
+    c->response.skip(n);
+    if (c->response.done())
+	return response_done(i);
+    return 1;
+}
+
+/**
+ * Slot i has received a whole response. Return FALSE if the connection
+ * was closed.
+ */
+int reactor::response_done(int i) {
+    conn_info_t *c = &conn_info[i];
+    int reusable = c->response.keep_alive();
+
+    if (c->response.status() > 0)
+	stats.http_code[c->response.status()]++;
+    stats.requests++;
+    int64_t start = c->request_start[c->responses % PIPELINE_MAX];
+    stats.latency[PHASE_TTFB].record(c->first_byte - start);
+    stats.latency[PHASE_TOTAL].record(time_interval::usec() - start);
+    account(i, TRACE_OK, 0);
+    c->responses++;
+    c->response.reset();
+    if (c->requests_sent > c->responses) {
+	const corpus_entry *e = c->request_entry[c->responses % PIPELINE_MAX];
+	if (e ? e->head : templates[c->url_number].head_only)
+	    c->response.no_body();
+    }
+    arm_timer(i);
+
+    // Without keep-alive the connection is finished as soon as its
+    // response is; don't wait for the server to close it. A server
+    // closing it early cuts off any requests pipelined behind.
+    if (!keepalive || c->responses >= requests_per_conn || !reusable) {
+	if (c->requests_sent > c->responses) {
+	    stats.response[HTTP_TRUNCATED] += in_flight(i);
+	    account(i, TRACE_RESPONSE, HTTP_TRUNCATED);
+	    if (debug)
+		printf("fd %d: %d requests unanswered\n", c->fd,
+		       c->requests_sent - c->responses);
+	}
+	close_connection(i);
+	return 0;
+    }
+    return send_next(i);
+}
+
+/**
+ * The peer closed slot i's connection, which may end a response whose
+ * length was not given. Then clean up.
+ */
+void reactor::handle_eof(int i) {
+    conn_info_t *c = &conn_info[i];
+
+    if (c->h2 != NULL) {
+	// Every stream still open is cut short.
+	if (c->h2->open_streams() > 0) {
+	    stats.response[HTTP_TRUNCATED] += in_flight(i);
+	    account(i, TRACE_RESPONSE, HTTP_TRUNCATED);
+	    if (debug)
+		printf("fd %d: %d streams truncated\n", c->fd, c->h2->open_streams());
+	}
+	close_connection(i);
+	return;
+    }
+    if (c->response.eof()) {
+	response_done(i);
+	return;
+    }
+    // A response begun or owed but not finished.
+    if (c->response.started() || c->requests_sent > c->responses) {
+	stats.response[HTTP_TRUNCATED] += in_flight(i);
+	account(i, TRACE_RESPONSE, HTTP_TRUNCATED);
+	if (debug)
+	    printf("fd %d: truncated response\n", c->fd);
+    }
+    close_connection(i);
+}
+
+/**
+ * Data is available on slot i. Read until the socket would block so
+ * that edge-triggered engines see the next arrival. Return FALSE if
+ * the connection was closed.
+ */
+int reactor::handle_read(int i) {
+    while (1) {
+	char buf[8192];
+	if (conn_info[i].ssl != NULL) {
+	    // Read until OpenSSL has nothing buffered either, since the
+	    // engine may not report the socket again.
+	    errno = 0;
+	    int n = SSL_read(conn_info[i].ssl, buf, sizeof(buf));
+	    stats.syscalls++;
+	    if (n > 0) {
+		if (!handle_data(i, buf, n))
+		    return 0;
+		continue;
+	    }
+	    int err = SSL_get_error(conn_info[i].ssl, n);
+	    if (err == SSL_ERROR_WANT_READ || err == SSL_ERROR_WANT_WRITE)
+		return 1;
+	    if (err == SSL_ERROR_ZERO_RETURN) {
+		if (debug)
+		    printf("fd %d tls closed\n", conn_info[i].fd);
+		handle_eof(i);
+		return 0;
+	    }
+	    tls_failed(i, err, TRACE_READ);
+	    return 0;
+	}
+	// With -D, body whose length we know is dropped in the kernel
+	// rather than copied out, as much as the socket holds at a time.
+	long long skip = discard && conn_info[i].h2 == NULL ?
+	    conn_info[i].response.body_pending() : 0;
+	int n;
+	if (skip > 0)
+	    n = recv(conn_info[i].fd, NULL, skip, MSG_DONTWAIT | MSG_TRUNC);
+	else
+	    n = recv(conn_info[i].fd, buf, sizeof(buf), MSG_DONTWAIT);
+	stats.syscalls++;
+	if (n < 0) {
+	    if (errno == EAGAIN || errno == EWOULDBLOCK)
+		return 1;
+	    if (errno == EINTR)
+		continue;
+	    stats.read[errno] += in_flight(i);
+	    account(i, TRACE_READ, errno);
+	    if (debug)
+		printf("fd %d read err: %d\n", conn_info[i].fd, errno);
+	    close_connection(i);
+	    return 0;
+	}
+	else if (n == 0) {
+	    // No data means peer closed the connection.
+	    if (debug)
+		printf("fd %d empty read\n", conn_info[i].fd);
+	    handle_eof(i);
+	    return 0;
+	}
+	else if (skip > 0) {
+	    if (!handle_discarded(i, n))
+		return 0;
+	}
+	else if (!handle_data(i, buf, n)) {
+	    return 0;
+	}
+    }
+}
+
+/**
+ * Dispatch the events reported for slot i.
+ */
+void reactor::handle_event(int i, int revents) {
+    // An event may be left over for a slot closed since it was reported.
+    if (conn_info[i].state == CONN_UNUSED)
+	return;
+
+    // Presumably a non-blocking connect error?
+    if (revents & POLLERR) {
+	int err = get_sock_error(i);
+	if (conn_info[i].state == CONN_CONNECTING) {
+	    stats.connect[err] += in_flight(i);
+	    account(i, TRACE_CONNECT, err);
+	}
+	else {
+	    stats.read[err] += in_flight(i);
+	    account(i, TRACE_READ, err);
+	}
+	if (debug)
+	    printf("fd %d err: %d\n", conn_info[i].fd, err);
+	close_connection(i);
+	return;
+    }
+
+    // Non-blocking connect succeeded or failed.
+    if ((revents & POLLOUT) && conn_info[i].state == CONN_CONNECTING) {
+	handle_connect(i, get_sock_error(i));
+	if (conn_info[i].state == CONN_UNUSED)
+	    return;
+    }
+
+    // The TLS handshake can go on.
+    if ((revents & (POLLIN|POLLOUT|POLLHUP)) && conn_info[i].state == CONN_HANDSHAKE) {
+	// Whatever woke us was for the handshake.
+	continue_handshake(i);
+	return;
+    }
+
+    // The socket has room for more of the request.
+    if ((revents & POLLOUT) && conn_info[i].state == CONN_WRITING) {
+	if (!(conn_info[i].h2 != NULL ? h2_flush(i) : write_request(i)))
+	    return;
+    }
+
+    // Data available. The server may answer before the whole request
+    // is sent.
+    if ((revents & POLLIN) && (conn_info[i].state == CONN_ESTABLISHED ||
+			       conn_info[i].state == CONN_WRITING)) {
+	if (!handle_read(i))
+	    return;
+    }
+
+    // Peer closed the connection.
+    if (revents & POLLHUP) {
+	if (debug)
+	    printf("fd %d closed\n", conn_info[i].fd);
+	handle_eof(i);
+    }
+}
+
+/**
+ * Dispatch the completion of an operation the engine performed for
+ * slot i.
+ */
+void reactor::handle_completion(event_t &ev) {
+    int i = ev.slot;
+    switch (ev.op) {
+    case EV_CONNECT:
+	handle_connect(i, -ev.res);
+	break;
+
+    case EV_WRITE: {
+	conn_info_t *c = &conn_info[i];
+	if (ev.res < 0) {
+	    // We can't write the request to the socket, give up.
+	    stats.write[-ev.res] += in_flight(i);
+	    account(i, TRACE_WRITE, -ev.res);
+	    if (debug)
+		printf("fd %d: write err: %d\n", c->fd, -ev.res);
+	    close_connection(i);
+	    break;
+	}
+	c->request_sent += ev.res;
+	if (c->request_sent >= c->request_len) {
+	    // Done; pipeline the next request, if any.
+	    if (!request_written(i))
+		break;
+	}
+	// Queue the rest of a short send, or the next request.
+	struct iovec iov[REQUEST_IOV_MAX];
+	int iovcnt = request_iov(templates[c->url_number], c->entry, c->cnt,
+				 c->cnt_len, c->request_sent, iov, 1);
+	engine->write(i, c->fd, iov, iovcnt);
+	break;
+    }
+
+    case EV_READ:
+	if (ev.res < 0) {
+	    stats.read[-ev.res] += in_flight(i);
+	    account(i, TRACE_READ, -ev.res);
+	    if (debug)
+		printf("fd %d read err: %d\n", conn_info[i].fd, -ev.res);
+	    close_connection(i);
+	}
+	else if (ev.res == 0) {
+	    // No data means peer closed the connection.
+	    if (debug)
+		printf("fd %d empty read\n", conn_info[i].fd);
+	    handle_eof(i);
+	}
+	else if (handle_data(i, ev.buf, ev.res)) {
+	    engine->read(i, conn_info[i].fd);
+	}
+	break;
+
+    default:
+	break;
+    }
+}
@@ -0,0 +1,126 @@
+#ifndef REACTOR_HH_
+#define REACTOR_HH_
+/*
+ * A reactor is one thread running an event loop over its own shard of
+ * connection slots. The control thread hands it waves to open and
+ * periodically collects its statistics; neither needs a lock.
+ */
+#include <atomic>
+#include <thread>
+
+#include "goofy.hh"
+#include "event.hh"
+#include "slots.hh"
+#include "timer.hh"
+
+// A reactor's share of one wave.
+struct wave_order {
+    int num;
+    // Request number and URL index of the first connection.
+    int first_request;
+    int first_url;
+    // When the wave was due, from time_interval::usec().
+    int64_t start;
+    // Where to connect.
+    const address_table *addresses;
+};
+
+class reactor {
+public:
+    // Create reactor id of _reactors, owning slots connection slots
+    // and waiting with the named engine. Exit if the engine cannot be
+    // created.
+    reactor(int _id, int _reactors, int _slots, const char *engine_name);
+
+    void start();
+    void stop();
+
+    // Control thread: queue a share of a wave.
+    void order(const wave_order &o);
+
+    // Control thread: ask for the statistics gathered since the last
+    // snapshot, then poll snapshot_ready() until TRUE. The result stays
+    // valid until the next request_snapshot().
+    void request_snapshot(unsigned epoch);
+    int snapshot_ready(unsigned epoch) const;
+    const wave_stat &snapshot() const { return published; }
+
+    const char *engine_name() const { return engine->name(); }
+
+private:
+    void run();
+    void take_orders();
+    void publish();
+
+    void set_state(int i, enum conn_state state);
+    void open_connections(const wave_order &o);
+    int bind_source(int fd, int family, int *src);
+    void sample_tcp(int i);
+    void close_connection(int i);
+    int get_sock_error(int i);
+    int in_flight(int i);
+    void account(int i, enum trace_kind kind, int err, const h2_stream *s = NULL);
+    void account_open_failure(int request_number, int url_number, int address,
+			      int src, int64_t scheduled, enum trace_kind kind, int err);
+    void arm_timer(int i);
+    void handle_timeout(int i);
+    void handle_connect(int i, int err);
+    void start_handshake(int i);
+    void continue_handshake(int i);
+    void tls_failed(int i, int err, enum trace_kind kind);
+    void connection_ready(int i);
+    int begin_request(int i);
+    int send_next(int i);
+    int write_request(int i);
+    int request_written(int i);
+    int handle_data(int i, char *buf, int n);
+    int handle_discarded(int i, int n);
+    int h2_send(int i);
+    int h2_flush(int i);
+    int h2_data(int i, char *buf, int n);
+    int response_done(int i);
+    void handle_eof(int i);
+    int handle_read(int i);
+    void handle_event(int i, int revents);
+    void handle_completion(event_t &ev);
+
+    // xorshift64*: cheap random numbers for picking corpus entries.
+    uint64_t random() {
+	rng ^= rng >> 12;
+	rng ^= rng << 25;
+	rng ^= rng >> 27;
+	return rng * 0x2545f4914f6cdd1dULL;
+    }
+
+    int id;
+    int slots;
+    event_engine *engine;
+    struct conn_info_t *conn_info;
+    slot_pool free_slots;
+    // Number of slots in each conn_state, kept up to date by set_state().
+    int live[CONN_STATES];
+    // HTTP/2 streams in flight on all its connections.
+    int open_streams;
+    wave_stat stats, published;
+    // Connection deadlines, or NULL if there are none.
+    timer_wheel *timers;
+    // TLS for https URLs, or NULL if there are none.
+    tls_client *tls;
+    // The next -s source to bind, and for each source with a port
+    // range, this reactor's share of it and the next port to bind.
+    int next_source;
+    std::vector<int> first_port, last_port, next_port;
+    uint64_t rng;
+    std::thread thread;
+
+    // Single-producer/single-consumer queue of orders from the control
+    // thread.
+    static const unsigned max_orders = 256;
+    wave_order orders[max_orders];
+    std::atomic<unsigned> orders_head, orders_tail;
+
+    std::atomic<unsigned> want_epoch, have_epoch;
+    std::atomic<bool> stopping;
+};
+
+#endif /* REACTOR_HH_ */
@@ -0,0 +1,327 @@
+#include "report.hh"
+#include <string.h>
+
+report_output *report_output::create(const char *spec) {
+    const char *colon = strchr(spec, ':');
+    std::string format(spec, colon ? colon - spec : strlen(spec));
+    FILE *f = stdout;
+
+    if (format != "json" && format != "csv")
+	return NULL;
+    if (colon != NULL && strcmp(colon + 1, "-") != 0) {
+	f = fopen(colon + 1, "w");
+	if (f == NULL) {
+	    perror(colon + 1);
+	    exit(1);
+	}
+    }
+    // Buffer whole records, even on a terminal or pipe.
+    setvbuf(f, NULL, _IOFBF, 1 << 16);
+
+    if (format == "json")
+	return new json_output(f);
+    return new csv_output(f);
+}
+
+/*
+ * Return map[key], or 0 if it is not there.
+ */
+static int count(const intmap &map, int key) {
+    intmap::const_iterator it = map.find(key);
+    return it == map.end() ? 0 : it->second;
+}
+
+/*
+ * JSON Lines: one object per period, then one summary object.
+ * Latencies are in milliseconds.
+ */
+
+void json_output::errnos(const char *name, const intmap &map) {
+    fprintf(out, ",\"%s\":{", name);
+    for (intmap::const_iterator it = map.begin(); it != map.end(); it++) {
+	const char *e = strerrorname_np(it->first);
+	fprintf(out, "%s\"%s\":%d", it == map.begin() ? "" : ",",
+		e ? e : "unknown", it->second);
+    }
+    fprintf(out, "}");
+}
+
+void json_output::latency(const char *name, const histogram &h) {
+    fprintf(out, "\"%s\":{\"count\":%llu", name, (unsigned long long) h.count());
+    if (h.count() > 0) {
+	fprintf(out, ",\"min\":%.3f,\"mean\":%.3f,\"p50\":%.3f,\"p90\":%.3f,"
+		"\"p99\":%.3f,\"p999\":%.3f,\"max\":%.3f",
+		h.min() / 1000.0, h.mean() / 1000.0, h.percentile(50) / 1000.0,
+		h.percentile(90) / 1000.0, h.percentile(99) / 1000.0,
+		h.percentile(99.9) / 1000.0, h.max() / 1000.0);
+    }
+    fprintf(out, "}");
+}
+
+void json_output::counts(const char *name, const intmap &map) {
+    fprintf(out, "\"%s\":{", name);
+    for (intmap::const_iterator it = map.begin(); it != map.end(); it++) {
+	fprintf(out, "%s\"%d\":%d", it == map.begin() ? "" : ",", it->first, it->second);
+    }
+    fprintf(out, "}");
+}
+
+// TCP_INFO samples, with -I only.
+void json_output::tcp(const wave_stat &stats) {
+    if (!tcp_sampling)
+	return;
+    fprintf(out, ",\"tcp\":{");
+    for (int m = 0; m < TCP_METRICS; m++) {
+	latency(tcp_metric_names[m], stats.tcp[m]);
+	fprintf(out, ",");
+    }
+    counts("syn_retries", stats.syn_retries);
+    fprintf(out, ",");
+    counts("retransmits", stats.retransmits);
+    fprintf(out, ",");
+    counts("lost", stats.lost);
+    fprintf(out, "}");
+}
+
+// goofy's own costs, in milliseconds.
+void json_output::self_costs(const wave_stat &stats, const self_stat &self) {
+    fprintf(out, ",\"self\":{\"cpu_user\":%.3f,\"cpu_sys\":%.3f,\"launch\":%.3f,"
+	    "\"dispatch\":%.3f,\"busiest\":%.3f,\"report\":%.3f,\"syscalls\":%lld,"
+	    "\"skipped\":%d,",
+	    self.user_us / 1000.0, self.sys_us / 1000.0, stats.launch_us / 1000.0,
+	    stats.dispatch_us / 1000.0, stats.busiest_us / 1000.0, self.report_us / 1000.0,
+	    stats.syscalls, self.skipped);
+    latency("loop_lag", stats.loop_lag);
+    fprintf(out, "}");
+}
+
+void json_output::by_address(const wave_stat &stats) {
+    const char *sep = "";
+    fprintf(out, ",\"addresses\":{");
+    for (int a = 0; a < naddresses.load(); a++) {
+	int opened = count(stats.addr_opened, a), errors = count(stats.addr_errors, a);
+	int responses = count(stats.addr_responses, a);
+	if (opened == 0 && errors == 0 && responses == 0)
+	    continue;
+	fprintf(out, "%s\"%s\":{\"opened\":%d,\"errors\":%d,\"responses\":%d}",
+		sep, addresses[a].name, opened, errors, responses);
+	sep = ",";
+    }
+    fprintf(out, "}");
+}
+
+void json_output::by_source(const wave_stat &stats) {
+    if (sources.empty())
+	return;
+    fprintf(out, ",\"sources\":{");
+    for (size_t s = 0; s < sources.size(); s++) {
+	fprintf(out, "%s\"%s\":{\"opened\":%d,\"errors\":%d}", s == 0 ? "" : ",",
+		sources[s].name, count(stats.src_opened, s), count(stats.src_errors, s));
+    }
+    fprintf(out, "}");
+}
+
+void json_output::period(double secs, const wave_stat &stats, const histogram &lag,
+			 const self_stat &self) {
+    intmap::const_iterator it;
+
+    fprintf(out, "{\"type\":\"period\",\"secs\":%.3f,\"opened\":%d,\"connected\":%d,"
+	    "\"closed\":%d,\"requests\":%d,\"streams\":%d,\"connecting\":%d,"
+	    "\"established\":%d,\"open_streams\":%d,"
+	    "\"handshakes\":%d,\"resumed\":%d,\"bytes\":%lld",
+	    secs, stats.opened, stats.connected, stats.closed, stats.requests, stats.streams,
+	    stats.connecting, stats.established, stats.open_streams, stats.handshakes,
+	    stats.resumed, stats.bytes);
+    errnos("socket", stats.socket);
+    errnos("bind", stats.bind);
+    errnos("connect", stats.connect);
+    errnos("read", stats.read);
+    errnos("write", stats.write);
+
+    fprintf(out, ",\"response\":{");
+    for (it = stats.response.begin(); it != stats.response.end(); it++) {
+	fprintf(out, "%s\"%s\":%d", it == stats.response.begin() ? "" : ",",
+		response_errors[it->first], it->second);
+    }
+    fprintf(out, "},\"tls\":{");
+    for (it = stats.tls.begin(); it != stats.tls.end(); it++) {
+	fprintf(out, "%s\"%s\":%d", it == stats.tls.begin() ? "" : ",",
+		tls_client::reason_string(it->first), it->second);
+    }
+    fprintf(out, "},\"timeout\":{");
+    for (it = stats.timeout.begin(); it != stats.timeout.end(); it++) {
+	fprintf(out, "%s\"%s\":%d", it == stats.timeout.begin() ? "" : ",",
+		phase_names[it->first], it->second);
+    }
+    fprintf(out, "},\"http\":{");
+    for (it = stats.http_code.begin(); it != stats.http_code.end(); it++) {
+	fprintf(out, "%s\"%d\":%d", it == stats.http_code.begin() ? "" : ",",
+		it->first, it->second);
+    }
+    fprintf(out, "},\"latency\":{");
+    for (int p = 0; p < PHASES; p++) {
+	if (p > 0)
+	    fprintf(out, ",");
+	latency(phase_names[p], stats.latency[p]);
+    }
+    fprintf(out, ",");
+    latency("lag", lag);
+    fprintf(out, "}");
+    tcp(stats);
+    self_costs(stats, self);
+    fprintf(out, ",\"behind\":%s", self.behind ? "true" : "false");
+    by_address(stats);
+    by_source(stats);
+    fprintf(out, "}\n");
+    fflush(out);
+}
+
+void json_output::summary(const wave_stat &totals, const histogram &lag,
+			  const self_stat &self) {
+    fprintf(out, "{\"type\":\"summary\",\"handshakes\":%d,\"resumed\":%d,\"bytes\":%lld,"
+	    "\"latency\":{", totals.handshakes, totals.resumed, totals.bytes);
+    for (int p = 0; p < PHASES; p++) {
+	latency(phase_names[p], totals.latency[p]);
+	fprintf(out, ",");
+    }
+    latency("lag", lag);
+    fprintf(out, "}");
+    tcp(totals);
+    self_costs(totals, self);
+    // In the totals, behind counts the periods goofy fell behind in.
+    fprintf(out, ",\"behind_periods\":%d", self.behind);
+    by_address(totals);
+    by_source(totals);
+    fprintf(out, "}\n");
+    fflush(out);
+}
+
+/*
+ * CSV: one row per period under a fixed header. The errno, response,
+ * TLS, timeout and HTTP status maps vary, so each is one column of "key=count"
+ * pairs separated by spaces. Addresses are "name=opened/errors/responses"
+ * and sources "name=opened/errors". Spaces in TLS reasons become
+ * underscores. The -I TCP_INFO columns come next, empty without -I,
+ * and goofy's own costs last.
+ */
+
+csv_output::csv_output(FILE *f) {
+    out = f;
+    fprintf(out, "secs,opened,connected,closed,requests,streams,connecting,established,"
+	    "open_streams,handshakes,resumed,bytes,socket,bind,connect,read,write,response,tls,timeout,http");
+    for (int p = 0; p < PHASES; p++)
+	fprintf(out, ",%s_count,%s_p50,%s_p90,%s_p99,%s_p999,%s_max",
+		phase_names[p], phase_names[p], phase_names[p],
+		phase_names[p], phase_names[p], phase_names[p]);
+    fprintf(out, ",lag_max,addresses,sources");
+    for (int m = 0; m < TCP_METRICS; m++)
+	fprintf(out, ",%s_count,%s_p50,%s_p90,%s_p99,%s_p999,%s_max",
+		tcp_metric_names[m], tcp_metric_names[m], tcp_metric_names[m],
+		tcp_metric_names[m], tcp_metric_names[m], tcp_metric_names[m]);
+    fprintf(out, ",syn_retries,retransmits,lost,cpu_user,cpu_sys,launch,dispatch,busiest,"
+	    "report,syscalls,loop_lag_count,loop_lag_p50,loop_lag_p90,loop_lag_p99,"
+	    "loop_lag_p999,loop_lag_max,skipped,behind\n");
+}
+
+void csv_output::latency(const histogram &h) {
+    fprintf(out, ",%llu", (unsigned long long) h.count());
+    if (h.count() > 0)
+	fprintf(out, ",%.3f,%.3f,%.3f,%.3f,%.3f", h.percentile(50) / 1000.0,
+		h.percentile(90) / 1000.0, h.percentile(99) / 1000.0,
+		h.percentile(99.9) / 1000.0, h.max() / 1000.0);
+    else
+	fprintf(out, ",,,,,");
+}
+
+void csv_output::counts(const intmap &map) {
+    fprintf(out, ",");
+    for (intmap::const_iterator it = map.begin(); it != map.end(); it++) {
+	fprintf(out, "%s%d=%d", it == map.begin() ? "" : " ", it->first, it->second);
+    }
+}
+
+void csv_output::errnos(const intmap &map) {
+    fprintf(out, ",");
+    for (intmap::const_iterator it = map.begin(); it != map.end(); it++) {
+	const char *e = strerrorname_np(it->first);
+	fprintf(out, "%s%s=%d", it == map.begin() ? "" : " ", e ? e : "unknown", it->second);
+    }
+}
+
+void csv_output::by_address(const wave_stat &stats) {
+    const char *sep = "";
+    fprintf(out, ",");
+    for (int a = 0; a < naddresses.load(); a++) {
+	int opened = count(stats.addr_opened, a), errors = count(stats.addr_errors, a);
+	int responses = count(stats.addr_responses, a);
+	if (opened == 0 && errors == 0 && responses == 0)
+	    continue;
+	fprintf(out, "%s%s=%d/%d/%d", sep, addresses[a].name, opened, errors, responses);
+	sep = " ";
+    }
+}
+
+void csv_output::by_source(const wave_stat &stats) {
+    fprintf(out, ",");
+    for (size_t s = 0; s < sources.size(); s++) {
+	fprintf(out, "%s%s=%d/%d", s == 0 ? "" : " ", sources[s].name,
+		count(stats.src_opened, s), count(stats.src_errors, s));
+    }
+}
+
+void csv_output::period(double secs, const wave_stat &stats, const histogram &lag,
+			const self_stat &self) {
+    intmap::const_iterator it;
+
+    fprintf(out, "%.3f,%d,%d,%d,%d,%d,%d,%d,%d,%d,%d,%lld", secs, stats.opened,
+	    stats.connected, stats.closed, stats.requests, stats.streams, stats.connecting,
+	    stats.established, stats.open_streams, stats.handshakes, stats.resumed, stats.bytes);
+    errnos(stats.socket);
+    errnos(stats.bind);
+    errnos(stats.connect);
+    errnos(stats.read);
+    errnos(stats.write);
+    fprintf(out, ",");
+    for (it = stats.response.begin(); it != stats.response.end(); it++) {
+	fprintf(out, "%s%s=%d", it == stats.response.begin() ? "" : " ",
+		response_errors[it->first], it->second);
+    }
+    fprintf(out, ",");
+    for (it = stats.tls.begin(); it != stats.tls.end(); it++) {
+	std::string reason = tls_client::reason_string(it->first);
+	for (size_t c = 0; c < reason.size(); c++) {
+	    if (reason[c] == ' ')
+		reason[c] = '_';
+	}
+	fprintf(out, "%s%s=%d", it == stats.tls.begin() ? "" : " ", reason.c_str(), it->second);
+    }
+    fprintf(out, ",");
+    for (it = stats.timeout.begin(); it != stats.timeout.end(); it++) {
+	fprintf(out, "%s%s=%d", it == stats.timeout.begin() ? "" : " ",
+		phase_names[it->first], it->second);
+    }
+    fprintf(out, ",");
+    for (it = stats.http_code.begin(); it != stats.http_code.end(); it++) {
+	fprintf(out, "%s%d=%d", it == stats.http_code.begin() ? "" : " ",
+		it->first, it->second);
+    }
+    for (int p = 0; p < PHASES; p++)
+	latency(stats.latency[p]);
+    if (lag.count() > 0)
+	fprintf(out, ",%.3f", lag.max() / 1000.0);
+    else
+	fprintf(out, ",");
+    by_address(stats);
+    by_source(stats);
+    for (int m = 0; m < TCP_METRICS; m++)
+	latency(stats.tcp[m]);
+    counts(stats.syn_retries);
+    counts(stats.retransmits);
+    counts(stats.lost);
+    fprintf(out, ",%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,%lld", self.user_us / 1000.0,
+	    self.sys_us / 1000.0, stats.launch_us / 1000.0, stats.dispatch_us / 1000.0,
+	    stats.busiest_us / 1000.0, self.report_us / 1000.0, stats.syscalls);
+    latency(stats.loop_lag);
+    fprintf(out, ",%d,%d\n", self.skipped, self.behind);
+    fflush(out);
+}
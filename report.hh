@@ -0,0 +1,71 @@
+#ifndef REPORT_HH_
+#define REPORT_HH_
+/*
+ * Machine-readable reports (-o). Each reporting period becomes one
+ * record holding every counter, errno and HTTP status seen and the
+ * latency percentiles, for dashboards to consume instead of scraping
+ * the table. Records go through stdio buffering and are flushed once
+ * each, so even short periods cost one write().
+ */
+#include <stdio.h>
+
+#include "goofy.hh"
+
+class report_output {
+public:
+    virtual ~report_output() {}
+
+    // Open the output named by "format[:file]", where format is json
+    // (JSON Lines) or csv and file defaults to stdout. Return NULL for
+    // an unknown format; exit if the file cannot be created.
+    static report_output *create(const char *spec);
+
+    // TRUE if records go to stdout, in place of the table.
+    int to_stdout() const { return out == stdout; }
+
+    // Write the counters for the period ending secs into the test.
+    // lag holds how late each of the period's waves was launched, and
+    // self the rest of goofy's own costs.
+    virtual void period(double secs, const wave_stat &stats, const histogram &lag,
+			const self_stat &self) = 0;
+
+    // Write each phase's latency over the whole run.
+    virtual void summary(const wave_stat &totals, const histogram &lag,
+			 const self_stat &self) {}
+
+protected:
+    FILE *out;
+};
+
+class json_output : public report_output {
+public:
+    json_output(FILE *f) { out = f; }
+    void period(double secs, const wave_stat &stats, const histogram &lag,
+		const self_stat &self);
+    void summary(const wave_stat &totals, const histogram &lag, const self_stat &self);
+
+private:
+    void errnos(const char *name, const intmap &map);
+    void counts(const char *name, const intmap &map);
+    void tcp(const wave_stat &stats);
+    void self_costs(const wave_stat &stats, const self_stat &self);
+    void by_address(const wave_stat &stats);
+    void by_source(const wave_stat &stats);
+    void latency(const char *name, const histogram &h);
+};
+
+class csv_output : public report_output {
+public:
+    csv_output(FILE *f);
+    void period(double secs, const wave_stat &stats, const histogram &lag,
+		const self_stat &self);
+
+private:
+    void errnos(const intmap &map);
+    void counts(const intmap &map);
+    void latency(const histogram &h);
+    void by_address(const wave_stat &stats);
+    void by_source(const wave_stat &stats);
+};
+
+#endif /* REPORT_HH_ */
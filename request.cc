@@ -0,0 +1,137 @@
+#include "request.hh"
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+request_body *open_body(const char *path) {
+    request_body *b = new request_body;
+    b->fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (b->fd < 0) {
+	perror(path);
+	exit(1);
+    }
+    struct stat st;
+    if (fstat(b->fd, &st) < 0) {
+	perror(path);
+	exit(1);
+    }
+    b->len = st.st_size;
+    b->length_len = snprintf(b->length, sizeof(b->length), "Content-Length: %lld\r\n",
+			     (long long) b->len);
+    b->data = NULL;
+    if (b->len > 0) {
+	void *p = mmap(NULL, b->len, PROT_READ, MAP_SHARED, b->fd, 0);
+	if (p == MAP_FAILED) {
+	    perror(path);
+	    exit(1);
+	}
+	b->data = (const char *) p;
+    }
+    return b;
+}
+
+request_template::request_template(url &u, const char *method, const request_body *_body,
+				   const std::vector<std::string> &headers,
+				   const char *version) : body(_body) {
+    int found_ua = 0, found_host = 0;
+
+    head = std::string(method) + " " + u.request();
+    head_only = (strcmp(method, "HEAD") == 0);
+    tail = std::string(" ") + version + "\r\n";
+    for (size_t i = 0; i < headers.size(); i++) {
+	tail += headers[i];
+	tail += "\r\n";
+	if (strncasecmp(headers[i].c_str(), "host:", 5) == 0) {
+	    found_host = 1;
+	}
+	if (strncasecmp(headers[i].c_str(), "user-agent:", 11) == 0) {
+	    found_ua = 1;
+	}
+    }
+    if (! found_host) {
+	if (u.host().find(':') != std::string::npos)
+	    tail += "Host: [" + u.host() + "]\r\n";
+	else
+	    tail += "Host: " + u.host() + "\r\n";
+    }
+    if (! found_ua) {
+	tail += "User-Agent: Goofy 0.0\r\n";
+    }
+    tail += "\r\n";
+}
+
+int request_cnt(int number, char *cnt) {
+    return snprintf(cnt, REQUEST_CNT_MAX, "&cnt=%d", number);
+}
+
+int iov_advance(struct iovec *iov, int iovcnt, size_t n) {
+    int skip = 0;
+    while (skip < iovcnt && n >= iov[skip].iov_len) {
+	n -= iov[skip].iov_len;
+	skip++;
+    }
+    if (skip > 0) {
+	memmove(iov, iov + skip, (iovcnt - skip) * sizeof(*iov));
+	iovcnt -= skip;
+    }
+    if (iovcnt > 0 && n > 0) {
+	iov[0].iov_base = (char *)iov[0].iov_base + n;
+	iov[0].iov_len -= n;
+    }
+    return iovcnt;
+}
+
+int request_iov(const request_template &t, const corpus_entry *e,
+		const char *cnt, int cnt_len, int sent, struct iovec *iov,
+		int with_body) {
+    int n = 0;
+    if (e == NULL) {
+	iov[n].iov_base = (void *)t.head.data();
+	iov[n++].iov_len = t.head.size();
+    }
+    else {
+	iov[n].iov_base = (void *)e->line;
+	iov[n++].iov_len = e->line_len;
+    }
+    if (cnt_len > 0) {
+	iov[n].iov_base = (void *)cnt;
+	iov[n++].iov_len = cnt_len;
+    }
+    iov[n].iov_base = (void *)t.tail.data();
+    iov[n++].iov_len = t.tail.size();
+    const request_body *body = request_body_of(t, e);
+    int extra_len = (e != NULL ? e->extra_len : 0);
+    if (extra_len > 0 || body != NULL) {
+	// The entry's headers and the length of whichever body this
+	// request sends go before the blank line that ends the template's.
+	iov[n-1].iov_len -= 2;
+	if (extra_len > 0) {
+	    iov[n].iov_base = (void *)e->extra;
+	    iov[n++].iov_len = extra_len;
+	}
+	if (body != NULL) {
+	    iov[n].iov_base = (void *)body->length;
+	    iov[n++].iov_len = body->length_len;
+	}
+	iov[n].iov_base = (void *)(t.tail.data() + t.tail.size() - 2);
+	iov[n++].iov_len = 2;
+    }
+    if (with_body && body != NULL) {
+	iov[n].iov_base = (void *)body->data;
+	iov[n++].iov_len = body->len;
+    }
+    return iov_advance(iov, n, sent);
+}
+
+int request_length(const request_template &t, const corpus_entry *e, int cnt_len) {
+    const request_body *body = request_body_of(t, e);
+    int len = cnt_len + t.tail.size() + (body != NULL ? body->length_len : 0);
+    if (e == NULL)
+	return t.head.size() + len;
+    return e->line_len + len + e->extra_len;
+}
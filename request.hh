@@ -0,0 +1,77 @@
+#ifndef REQUEST_HH_
+#define REQUEST_HH_
+/*
+ * Requests are rendered once per URL at startup. Sending one is then a
+ * single writev() of the immutable template pieces, with only the -u
+ * "&cnt=N" counter formatted per request. A -C corpus entry replaces
+ * the template's "GET /path?query" and adds its own headers. Bodies
+ * stay in their files and follow the headers by sendfile(), or from a
+ * mapping of the file where the socket can't take sendfile().
+ */
+#include <string>
+#include <vector>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include "url.hh"
+#include "corpus.hh"
+
+// The most iovecs a request needs.
+#define REQUEST_IOV_MAX 7
+
+// Room for "&cnt=" and any int.
+#define REQUEST_CNT_MAX 16
+
+// A request body: an open file, a read-only mapping of it, and the
+// Content-Length header announcing it.
+struct request_body {
+    int fd;
+    off_t len;
+    const char *data;
+    char length[40];
+    int length_len;
+};
+
+// Open and map the body in path. Exit if it cannot be read.
+request_body *open_body(const char *path);
+
+struct request_template {
+    // Render the version request for u with method, adding headers. The
+    // body, if not NULL, is announced per request by request_iov().
+    request_template(url &u, const char *method, const request_body *body,
+                     const std::vector<std::string> &headers, const char *version);
+
+    // "METHOD /path?query", and everything from " HTTP/1.x" on except
+    // Content-Length.
+    std::string head, tail;
+    const request_body *body;
+    // A HEAD request, whose response has no body.
+    bool head_only;
+};
+
+/*
+ * Fill in iov with the request for t, or corpus entry e if not NULL,
+ * whose unique counter text (or "" without -u) is cnt, skipping the
+ * first sent bytes. The body is included only if with_body. Return the
+ * number of iovecs used.
+ */
+int request_iov(const request_template &t, const corpus_entry *e,
+                const char *cnt, int cnt_len, int sent, struct iovec *iov,
+                int with_body);
+
+// Return the length of the same request's headers.
+int request_length(const request_template &t, const corpus_entry *e, int cnt_len);
+
+// Return the same request's body, or NULL.
+inline const request_body *request_body_of(const request_template &t,
+                                           const corpus_entry *e) {
+    return e != NULL ? e->body : t.body;
+}
+
+// Format the -u counter for request number into cnt; return its length.
+int request_cnt(int number, char *cnt);
+
+// Drop the first n bytes from the iovcnt iovecs at iov, in place.
+// Return the new count.
+int iov_advance(struct iovec *iov, int iovcnt, size_t n);
+
+#endif /* REQUEST_HH_ */
@@ -0,0 +1,124 @@
+#include "resolve.hh"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+address addresses[MAX_ADDRESSES];
+std::atomic<int> naddresses;
+
+resolver::resolver(std::vector<url> &_urls)
+    : urls(_urls), requests(_urls.size()), list(_urls.size()), pending(0) {
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    for (size_t i = 0; i < urls.size(); i++)
+	ports.push_back(std::to_string(urls[i].port()));
+}
+
+resolver::~resolver() {
+    for (size_t i = 0; i < tables.size(); i++)
+	delete tables[i];
+}
+
+/**
+ * Start looking up every URL's host at once.
+ */
+void resolver::submit(int mode) {
+    for (size_t i = 0; i < urls.size(); i++) {
+	memset(&requests[i], 0, sizeof(requests[i]));
+	requests[i].ar_name = urls[i].host().c_str();
+	requests[i].ar_service = ports[i].c_str();
+	requests[i].ar_request = &hints;
+	list[i] = &requests[i];
+    }
+    int err = getaddrinfo_a(mode, list.data(), list.size(), NULL);
+    if (err != 0) {
+	fprintf(stderr, "getaddrinfo_a: %s\n", gai_strerror(err));
+	exit(1);
+    }
+    pending = 1;
+}
+
+/**
+ * Return the number of address sa, numbering it if it is new.
+ */
+int resolver::number(const struct sockaddr *sa, socklen_t len) {
+    int n = naddresses.load(std::memory_order_relaxed);
+    for (int k = 0; k < n; k++) {
+	if (addresses[k].len == len && memcmp(&addresses[k].sa, sa, len) == 0)
+	    return k;
+    }
+    if (n == MAX_ADDRESSES) {
+	fprintf(stderr, "too many addresses\n");
+	exit(1);
+    }
+
+    address *a = &addresses[n];
+    char host[INET6_ADDRSTRLEN];
+    memcpy(&a->sa, sa, len);
+    a->len = len;
+    if (sa->sa_family == AF_INET6) {
+	const struct sockaddr_in6 *sin6 = (const struct sockaddr_in6 *) sa;
+	inet_ntop(AF_INET6, &sin6->sin6_addr, host, sizeof(host));
+	snprintf(a->name, sizeof(a->name), "[%s]:%d", host, ntohs(sin6->sin6_port));
+    }
+    else {
+	const struct sockaddr_in *sin = (const struct sockaddr_in *) sa;
+	inet_ntop(AF_INET, &sin->sin_addr, host, sizeof(host));
+	snprintf(a->name, sizeof(a->name), "%s:%d", host, ntohs(sin->sin_port));
+    }
+    // Publish the entry before its number.
+    naddresses.store(n + 1, std::memory_order_release);
+    return n;
+}
+
+/**
+ * Build a table from finished lookups. A failed lookup is fatal if
+ * fatal is set, and otherwise keeps the URL's previous addresses.
+ */
+const address_table *resolver::collect(int fatal) {
+    address_table *t = new address_table;
+    t->by_url.resize(urls.size());
+
+    for (size_t i = 0; i < urls.size(); i++) {
+	int err = gai_error(&requests[i]);
+	if (err != 0) {
+	    if (fatal) {
+		fprintf(stderr, "cannot resolve host: %s: %s\n", urls[i].host().c_str(),
+			gai_strerror(err));
+		exit(1);
+	    }
+	    fprintf(stderr, "re-resolving %s: %s; keeping old addresses\n",
+		    urls[i].host().c_str(), gai_strerror(err));
+	    t->by_url[i] = tables.back()->by_url[i];
+	    continue;
+	}
+	for (struct addrinfo *ai = requests[i].ar_result; ai != NULL; ai = ai->ai_next)
+	    t->by_url[i].push_back(number(ai->ai_addr, ai->ai_addrlen));
+	freeaddrinfo(requests[i].ar_result);
+	requests[i].ar_result = NULL;
+    }
+    pending = 0;
+    tables.push_back(t);
+    return t;
+}
+
+const address_table *resolver::resolve() {
+    submit(GAI_WAIT);
+    return collect(1);
+}
+
+void resolver::start() {
+    if (!pending)
+	submit(GAI_NOWAIT);
+}
+
+const address_table *resolver::finished() {
+    if (!pending)
+	return NULL;
+    for (size_t i = 0; i < urls.size(); i++) {
+	if (gai_error(&requests[i]) == EAI_INPROGRESS)
+	    return NULL;
+    }
+    return collect(0);
+}
@@ -0,0 +1,73 @@
+#ifndef RESOLVE_HH_
+#define RESOLVE_HH_
+/*
+ * Name resolution. Every URL's host is looked up with getaddrinfo_a(),
+ * all hosts at once and, after startup, without blocking the control
+ * loop. Connections are spread over every address a host has. Each
+ * distinct address is numbered once, in the order first seen, so
+ * per-address statistics stay meaningful across re-resolution.
+ */
+#include <netdb.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <atomic>
+#include <string>
+#include <vector>
+
+#include "url.hh"
+
+#define MAX_ADDRESSES 1024
+
+struct address {
+    struct sockaddr_storage sa;
+    socklen_t len;
+    // "host:port", or "[host]:port" for IPv6.
+    char name[INET6_ADDRSTRLEN + 8];
+};
+
+// Every address seen, by number. Only the control thread adds to it;
+// an entry never changes once naddresses covers it.
+extern address addresses[MAX_ADDRESSES];
+extern std::atomic<int> naddresses;
+
+// The address numbers of each URL. Tables are never changed once
+// built; re-resolution builds a new one.
+struct address_table {
+    std::vector<std::vector<int> > by_url;
+};
+
+class resolver {
+public:
+    resolver(std::vector<url> &_urls);
+    ~resolver();
+
+    // Look up every URL and wait for the answers. Exit if any host
+    // cannot be resolved.
+    const address_table *resolve();
+
+    // Begin looking up every URL again in the background, unless a
+    // lookup is still running.
+    void start();
+
+    // If the lookup begun by start() has finished, return the new
+    // table, else NULL. A host that now fails keeps its old addresses.
+    const address_table *finished();
+
+private:
+    void submit(int mode);
+    const address_table *collect(int fatal);
+    static int number(const struct sockaddr *sa, socklen_t len);
+
+    std::vector<url> &urls;
+    std::vector<std::string> ports;
+    struct addrinfo hints;
+    std::vector<struct gaicb> requests;
+    std::vector<struct gaicb *> list;
+    int pending;
+    // Every table built. Reactors may still be using an old one, so
+    // they are all kept until the resolver goes away.
+    std::vector<address_table *> tables;
+};
+
+#endif /* RESOLVE_HH_ */
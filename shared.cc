@@ -0,0 +1,108 @@
+/*
+ * The settings and counters goofy.cc shares with the reactors and the
+ * report writers, kept apart from main() so that everything but main()
+ * can be linked into libgoofy.a and driven by goofy-bench.
+ */
+
+#include <stdio.h>
+
+#include "goofy.hh"
+
+int debug;
+int unique;
+// HTTP/1.1 persistent connections carrying requests_per_conn requests,
+// up to pipeline_depth at a time.
+int keepalive;
+int requests_per_conn = 1;
+int pipeline_depth = 1;
+// With -2, HTTP/2 connections carrying up to h2_streams of their
+// requests_per_conn requests at a time, as streams; 0 for HTTP/1.
+int h2_streams;
+// Throw response bodies away in the kernel (-D).
+int discard;
+// Sample each connection's TCP_INFO (-I).
+int tcp_sampling;
+// Milliseconds allowed to connect (with any TLS handshake), and for a
+// request's first byte and whole response; 0 for no limit.
+int connect_timeout, ttfb_timeout, total_timeout;
+const char *phase_names[PHASES] = { "connect", "handshake", "ttfb", "total" };
+const char *tcp_metric_names[TCP_METRICS] = { "syn_rtt", "rtt", "rttvar" };
+urlvec urls;
+std::vector<request_template> templates;
+std::vector<h2_request> h2_requests;
+strvec headers;
+trace_file *tracer;
+strmap response_errors = {
+    { HTTP_MALFORMED, "malformed" },
+    { HTTP_TRUNCATED, "truncated" },
+    { HTTP_RESET, "reset" },
+};
+enum tls_resume tls_resumption = TLS_RESUME_NONE;
+
+/**
+ * Display a latency in microseconds as milliseconds in five columns.
+ */
+void print_ms(int64_t usec) {
+    double ms = usec / 1000.0;
+    printf(ms < 1000 ? " %5.1f" : " %5.0f", ms);
+}
+
+void wave_stat::merge(const wave_stat &other) {
+    intmap::const_iterator it;
+
+    opened += other.opened;
+    connected += other.connected;
+    requests += other.requests;
+    streams += other.streams;
+    open_streams += other.open_streams;
+    handshakes += other.handshakes;
+    resumed += other.resumed;
+    bytes += other.bytes;
+    closed += other.closed;
+    connecting += other.connecting;
+    established += other.established;
+    for (it = other.socket.begin(); it != other.socket.end(); it++)
+	socket[it->first] += it->second;
+    for (it = other.bind.begin(); it != other.bind.end(); it++)
+	bind[it->first] += it->second;
+    for (it = other.connect.begin(); it != other.connect.end(); it++)
+	connect[it->first] += it->second;
+    for (it = other.read.begin(); it != other.read.end(); it++)
+	read[it->first] += it->second;
+    for (it = other.write.begin(); it != other.write.end(); it++)
+	write[it->first] += it->second;
+    for (it = other.http_code.begin(); it != other.http_code.end(); it++)
+	http_code[it->first] += it->second;
+    for (it = other.response.begin(); it != other.response.end(); it++)
+	response[it->first] += it->second;
+    for (it = other.tls.begin(); it != other.tls.end(); it++)
+	tls[it->first] += it->second;
+    for (it = other.timeout.begin(); it != other.timeout.end(); it++)
+	timeout[it->first] += it->second;
+    for (it = other.syn_retries.begin(); it != other.syn_retries.end(); it++)
+	syn_retries[it->first] += it->second;
+    for (it = other.retransmits.begin(); it != other.retransmits.end(); it++)
+	retransmits[it->first] += it->second;
+    for (it = other.lost.begin(); it != other.lost.end(); it++)
+	lost[it->first] += it->second;
+    for (it = other.addr_opened.begin(); it != other.addr_opened.end(); it++)
+	addr_opened[it->first] += it->second;
+    for (it = other.addr_errors.begin(); it != other.addr_errors.end(); it++)
+	addr_errors[it->first] += it->second;
+    for (it = other.addr_responses.begin(); it != other.addr_responses.end(); it++)
+	addr_responses[it->first] += it->second;
+    for (it = other.src_opened.begin(); it != other.src_opened.end(); it++)
+	src_opened[it->first] += it->second;
+    for (it = other.src_errors.begin(); it != other.src_errors.end(); it++)
+	src_errors[it->first] += it->second;
+    for (int p = 0; p < PHASES; p++)
+	latency[p].merge(other.latency[p]);
+    for (int m = 0; m < TCP_METRICS; m++)
+	tcp[m].merge(other.tcp[m]);
+    launch_us += other.launch_us;
+    dispatch_us += other.dispatch_us;
+    if (other.busiest_us > busiest_us)
+	busiest_us = other.busiest_us;
+    syscalls += other.syscalls;
+    loop_lag.merge(other.loop_lag);
+}
@@ -0,0 +1,36 @@
+#ifndef SLOTS_HH_
+#define SLOTS_HH_
+/*
+ * A free list of connection slot numbers. get() and put() are O(1), so
+ * opening a wave costs time proportional to its size rather than to
+ * the size of the slot table.
+ */
+#include <vector>
+
+class slot_pool {
+public:
+    // Make slots 0..n-1 available, lowest first.
+    slot_pool(int n) : free_slots(n) {
+	for (int i = 0; i < n; i++)
+	    free_slots[i] = n - 1 - i;
+    }
+
+    // Return an unused slot, or -1 if none is left.
+    int get() {
+	if (free_slots.empty())
+	    return -1;
+	int slot = free_slots.back();
+	free_slots.pop_back();
+	return slot;
+    }
+
+    // Return slot to the pool.
+    void put(int slot) { free_slots.push_back(slot); }
+
+    int available() const { return free_slots.size(); }
+
+private:
+    std::vector<int> free_slots;
+};
+
+#endif /* SLOTS_HH_ */
@@ -0,0 +1,60 @@
+#include "source.hh"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+std::vector<source> sources;
+
+int parse_source(const char *spec, source *s) {
+    char host[INET6_ADDRSTRLEN];
+    const char *ports;
+
+    memset(s, 0, sizeof(*s));
+    if (strlen(spec) >= sizeof(s->name))
+	return 0;
+    strcpy(s->name, spec);
+
+    // Split off the host, which IPv6 brackets.
+    if (spec[0] == '[') {
+	const char *end = strchr(spec, ']');
+	if (end == NULL || end - spec - 1 >= (int) sizeof(host))
+	    return 0;
+	memcpy(host, spec + 1, end - spec - 1);
+	host[end - spec - 1] = 0;
+	ports = (end[1] == ':' ? end + 2 : end[1] == 0 ? NULL : end);
+	if (ports == end)
+	    return 0;
+    }
+    else {
+	const char *colon = strchr(spec, ':');
+	size_t n = colon ? colon - spec : strlen(spec);
+	if (n >= sizeof(host))
+	    return 0;
+	memcpy(host, spec, n);
+	host[n] = 0;
+	ports = colon ? colon + 1 : NULL;
+    }
+
+    if (ports != NULL) {
+	char *end;
+	s->port_lo = strtol(ports, &end, 10);
+	s->port_hi = (*end == '-' ? strtol(end + 1, &end, 10) : s->port_lo);
+	if (*end != 0 || s->port_lo < 1 || s->port_hi > 65535 || s->port_lo > s->port_hi)
+	    return 0;
+    }
+
+    struct sockaddr_in *sin = (struct sockaddr_in *) &s->sa;
+    struct sockaddr_in6 *sin6 = (struct sockaddr_in6 *) &s->sa;
+    if (inet_pton(AF_INET, host, &sin->sin_addr) == 1) {
+	sin->sin_family = AF_INET;
+	s->len = sizeof(*sin);
+    }
+    else if (inet_pton(AF_INET6, host, &sin6->sin6_addr) == 1) {
+	sin6->sin6_family = AF_INET6;
+	s->len = sizeof(*sin6);
+    }
+    else {
+	return 0;
+    }
+    return 1;
+}
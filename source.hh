@@ -0,0 +1,30 @@
+#ifndef SOURCE_HH_
+#define SOURCE_HH_
+/*
+ * Local source addresses (-s). One source address can only have about
+ * 28k connections in TIME_WAIT or open to a given server ip:port, so
+ * large tests spread their connections over several. A source either
+ * lets the kernel choose the port at connect() time
+ * (IP_BIND_ADDRESS_NO_PORT), which allows a full port range per
+ * destination, or binds ports from a given range in turn.
+ */
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <vector>
+
+struct source {
+    struct sockaddr_storage sa;
+    socklen_t len;
+    // The ports to bind, or 0 and 0 to let the kernel choose.
+    int port_lo, port_hi;
+    // As given: "ip[:lo-hi]", with IPv6 addresses bracketed.
+    char name[INET6_ADDRSTRLEN + 16];
+};
+
+// Parse "ip[:lo-hi]" into s. Return FALSE if it makes no sense.
+int parse_source(const char *spec, source *s);
+
+extern std::vector<source> sources;
+
+#endif /* SOURCE_HH_ */
@@ -0,0 +1,132 @@
+#include "timer.hh"
+#include <limits.h>
+#include <string.h>
+
+timer_wheel::timer_wheel(int n, int64_t now)
+    : current(now), count(0), heads(levels * size, -1), next_slot(n, -1),
+      prev_slot(n, -1), expires(n, -1), bucket(n, -1) {
+    memset(occupied, 0, sizeof(occupied));
+}
+
+/*
+ * Put slot in the bucket for its deadline: the finest wheel that
+ * reaches that far, at the position the deadline's bits give. A timer
+ * in wheel L is cascaded down when that wheel's position comes round,
+ * which is no later than it is due.
+ */
+void timer_wheel::link(int slot) {
+    int64_t when = expires[slot] > current ? expires[slot] : current;
+    int64_t delta = when - current;
+    int level = 0;
+    while (level < levels - 1 && delta >= (int64_t) 1 << (bits * (level + 1)))
+	level++;
+    if (delta >= (int64_t) 1 << (bits * levels))
+	when = current + ((int64_t) 1 << (bits * levels)) - 1;
+    int b = level * size + ((when >> (bits * level)) & (size - 1));
+
+    bucket[slot] = b;
+    prev_slot[slot] = -1;
+    next_slot[slot] = heads[b];
+    if (heads[b] >= 0)
+	prev_slot[heads[b]] = slot;
+    heads[b] = slot;
+    if (b < size)
+	occupied[b / 64] |= 1ULL << (b % 64);
+}
+
+void timer_wheel::unlink(int slot) {
+    int b = bucket[slot];
+    if (prev_slot[slot] >= 0)
+	next_slot[prev_slot[slot]] = next_slot[slot];
+    else
+	heads[b] = next_slot[slot];
+    if (next_slot[slot] >= 0)
+	prev_slot[next_slot[slot]] = prev_slot[slot];
+    if (b < size && heads[b] < 0)
+	occupied[b / 64] &= ~(1ULL << (b % 64));
+    bucket[slot] = -1;
+}
+
+void timer_wheel::schedule(int slot, int64_t when) {
+    if (expires[slot] >= 0)
+	unlink(slot);
+    else
+	count++;
+    // The current bucket may already have been emptied.
+    expires[slot] = when > current ? when : current + 1;
+    link(slot);
+}
+
+void timer_wheel::cancel(int slot) {
+    if (expires[slot] < 0)
+	return;
+    unlink(slot);
+    expires[slot] = -1;
+    count--;
+}
+
+/*
+ * Move the timers in level's current bucket to finer wheels.
+ */
+void timer_wheel::cascade(int level) {
+    int b = level * size + ((current >> (bits * level)) & (size - 1));
+    int slot = heads[b];
+    heads[b] = -1;
+    while (slot >= 0) {
+	int next = next_slot[slot];
+	link(slot);
+	slot = next;
+    }
+}
+
+int timer_wheel::expired(int64_t now) {
+    while (1) {
+	// Everything in the current level 0 bucket is due.
+	int slot = heads[current & (size - 1)];
+	if (slot >= 0) {
+	    unlink(slot);
+	    expires[slot] = -1;
+	    count--;
+	    return slot;
+	}
+	if (current >= now)
+	    return -1;
+	if (count == 0) {
+	    // Nothing to cascade on the way.
+	    current = now;
+	    return -1;
+	}
+	current++;
+	// Entering a new position in coarser wheels: bring their timers
+	// down, coarsest first.
+	if ((current & (size - 1)) == 0) {
+	    int level = 1;
+	    while (level < levels - 1 && ((current >> (bits * level)) & (size - 1)) == 0)
+		level++;
+	    for (; level >= 1; level--)
+		cascade(level);
+	}
+    }
+}
+
+int timer_wheel::next(int64_t now) const {
+    if (count == 0)
+	return -1;
+    // The first busy level 0 bucket before the next cascade, or else
+    // the cascade, which may bring some.
+    int64_t t = current, boundary = (current | (size - 1)) + 1;
+    while (t < boundary) {
+	int b = t & (size - 1);
+	uint64_t w = occupied[b / 64] >> (b % 64);
+	if (w != 0) {
+	    t += __builtin_ctzll(w);
+	    break;
+	}
+	t += 64 - b % 64;
+    }
+    if (t > boundary)
+	t = boundary;
+    if (t <= now)
+	return 0;
+    return t - now < INT_MAX ? t - now : INT_MAX;
+}
@@ -0,0 +1,56 @@
+#ifndef TIMER_HH_
+#define TIMER_HH_
+/*
+ * A hierarchical timer wheel holding at most one deadline per
+ * connection slot. Four wheels of 256 one-millisecond buckets cover
+ * about 49 days; a deadline goes in the finest wheel that reaches it
+ * and drops to finer ones as the time comes closer. Timers are linked
+ * through arrays indexed by slot, so scheduling and cancelling are O(1)
+ * and allocate nothing.
+ */
+#include <stdint.h>
+#include <vector>
+
+class timer_wheel {
+public:
+    // Make a wheel for slots 0..n-1 starting at now, in milliseconds.
+    timer_wheel(int n, int64_t now);
+
+    // Set slot's deadline to when, replacing any it had.
+    void schedule(int slot, int64_t when);
+
+    // Remove slot's deadline, if any.
+    void cancel(int slot);
+
+    // TRUE if slot has a deadline.
+    int scheduled(int slot) const { return expires[slot] >= 0; }
+
+    // Return a slot whose deadline has passed by now, removing its
+    // deadline, or -1 if there are no more.
+    int expired(int64_t now);
+
+    // Return how many milliseconds after now the next deadline may be
+    // due, or -1 if there are none.
+    int next(int64_t now) const;
+
+private:
+    static const int bits = 8, size = 1 << bits, levels = 4;
+
+    void link(int slot);
+    void unlink(int slot);
+    void cascade(int level);
+
+    // The last tick whose level 0 bucket has been emptied, or is being.
+    int64_t current;
+    int count;
+    // Bucket heads, and each slot's neighbours, deadline (-1 if it has
+    // none) and bucket.
+    std::vector<int> heads;
+    std::vector<int> next_slot, prev_slot;
+    std::vector<int64_t> expires;
+    std::vector<int> bucket;
+    // Which level 0 buckets are not empty.
+    uint64_t occupied[size / 64];
+};
+
+#endif /* TIMER_HH_ */
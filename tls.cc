@@ -0,0 +1,88 @@
+#include "tls.hh"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+tls_client::tls_client(int urls, enum tls_resume _mode)
+    : mode(_mode), sessions(urls, (SSL_SESSION *) NULL) {
+    ctx = SSL_CTX_new(TLS_client_method());
+    if (ctx == NULL) {
+	ERR_print_errors_fp(stderr);
+	exit(1);
+    }
+    SSL_CTX_set_verify(ctx, SSL_VERIFY_NONE, NULL);
+    SSL_CTX_set_mode(ctx, SSL_MODE_ENABLE_PARTIAL_WRITE);
+    // HTTP/1.0 servers close without a close_notify; that's just EOF.
+    SSL_CTX_set_options(ctx, SSL_OP_IGNORE_UNEXPECTED_EOF);
+
+    switch (mode) {
+    case TLS_RESUME_NONE:
+	SSL_CTX_set_options(ctx, SSL_OP_NO_TICKET);
+	SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_OFF);
+	break;
+    case TLS_RESUME_ID:
+	// Session IDs went away in TLS 1.3.
+	SSL_CTX_set_options(ctx, SSL_OP_NO_TICKET);
+	SSL_CTX_set_max_proto_version(ctx, TLS1_2_VERSION);
+	break;
+    case TLS_RESUME_TICKET:
+	break;
+    }
+    if (mode != TLS_RESUME_NONE) {
+	// Keep sessions ourselves, as they arrive; under TLS 1.3 that is
+	// after the handshake.
+	SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+	SSL_CTX_sess_set_new_cb(ctx, new_session);
+	SSL_CTX_set_app_data(ctx, this);
+    }
+}
+
+tls_client::~tls_client() {
+    for (size_t i = 0; i < sessions.size(); i++) {
+	if (sessions[i] != NULL)
+	    SSL_SESSION_free(sessions[i]);
+    }
+    SSL_CTX_free(ctx);
+}
+
+SSL *tls_client::connect(int fd, const char *host, int url_number) {
+    SSL *ssl = SSL_new(ctx);
+    if (ssl == NULL) {
+	ERR_print_errors_fp(stderr);
+	exit(1);
+    }
+    SSL_set_fd(ssl, fd);
+    SSL_set_tlsext_host_name(ssl, host);
+    SSL_set_app_data(ssl, (void *) (intptr_t) url_number);
+    if (sessions[url_number] != NULL)
+	SSL_set_session(ssl, sessions[url_number]);
+    SSL_set_connect_state(ssl);
+    return ssl;
+}
+
+/*
+ * OpenSSL has a session for us to resume later. Keep it for the
+ * connection's URL in place of the last one.
+ */
+int tls_client::new_session(SSL *ssl, SSL_SESSION *session) {
+    tls_client *t = (tls_client *) SSL_CTX_get_app_data(SSL_get_SSL_CTX(ssl));
+    int url_number = (int) (intptr_t) SSL_get_app_data(ssl);
+    if (t->sessions[url_number] != NULL)
+	SSL_SESSION_free(t->sessions[url_number]);
+    t->sessions[url_number] = session;
+    // We took the reference.
+    return 1;
+}
+
+int tls_client::error_reason() {
+    unsigned long e = ERR_get_error();
+    ERR_clear_error();
+    return ERR_GET_REASON(e);
+}
+
+const char *tls_client::reason_string(int reason) {
+    if (reason == 0)
+	return "unexpected eof";
+    const char *s = ERR_reason_error_string(ERR_PACK(ERR_LIB_SSL, 0, reason));
+    return s ? s : "unknown";
+}
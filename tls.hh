@@ -0,0 +1,43 @@
+#ifndef TLS_HH_
+#define TLS_HH_
+/*
+ * TLS for https:// URLs. Each reactor has its own tls_client, and so
+ * its own SSL_CTX and session cache; nothing is shared between
+ * threads. Certificates are not verified: goofy measures servers, it
+ * does not protect data.
+ */
+#include <openssl/ssl.h>
+#include <openssl/err.h>
+#include <vector>
+
+// Whether and how connections resume earlier TLS sessions (-S).
+enum tls_resume { TLS_RESUME_NONE = 0, TLS_RESUME_ID, TLS_RESUME_TICKET };
+
+class tls_client {
+public:
+    // Make a client for urls URLs resuming sessions per mode. Exit on
+    // failure.
+    tls_client(int urls, enum tls_resume mode);
+    ~tls_client();
+
+    // Return a new client connection on fd to host, the URL url_number,
+    // offering the last session that URL's server gave us, if any.
+    SSL *connect(int fd, const char *host, int url_number);
+
+    // Return the reason for the last failure of this thread's TLS
+    // call, clearing the error queue, or 0 if it was not TLS's fault.
+    static int error_reason();
+
+    // Describe the failure reason returned by error_reason().
+    static const char *reason_string(int reason);
+
+private:
+    static int new_session(SSL *ssl, SSL_SESSION *session);
+
+    SSL_CTX *ctx;
+    enum tls_resume mode;
+    // The session to offer each URL's server next.
+    std::vector<SSL_SESSION *> sessions;
+};
+
+#endif /* TLS_HH_ */
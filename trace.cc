@@ -0,0 +1,72 @@
+#include "trace.hh"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+const char *trace_kind_names[TRACE_KINDS] = {
+    "ok", "socket", "connect", "write", "read", "response", "bind", "tls",
+    "timeout"
+};
+
+trace_file::trace_file(const char *path, uint64_t capacity) {
+    int fd = open(path, capacity ? O_RDWR|O_CREAT|O_TRUNC : O_RDONLY, 0644);
+    if (fd < 0) {
+	perror(path);
+	exit(1);
+    }
+
+    size_t size;
+    if (capacity) {
+	size = sizeof(trace_header) + capacity * sizeof(trace_record);
+	if (ftruncate(fd, size) < 0) {
+	    perror("ftruncate");
+	    exit(1);
+	}
+    }
+    else {
+	struct stat st;
+	if (fstat(fd, &st) < 0) {
+	    perror("fstat");
+	    exit(1);
+	}
+	size = st.st_size;
+    }
+
+    void *p = mmap(NULL, size, capacity ? PROT_READ|PROT_WRITE : PROT_READ, MAP_SHARED, fd, 0);
+    if (p == MAP_FAILED) {
+	perror("mmap");
+	exit(1);
+    }
+    close(fd);
+    header = (trace_header *) p;
+    records = (trace_record *) (header + 1);
+
+    if (capacity) {
+	memcpy(header->magic, TRACE_MAGIC, sizeof(header->magic));
+	header->record_size = sizeof(trace_record);
+	header->capacity = capacity;
+	header->appended.store(0);
+    }
+    else if (size < sizeof(trace_header) ||
+	     memcmp(header->magic, TRACE_MAGIC, sizeof(header->magic)) != 0 ||
+	     header->record_size != sizeof(trace_record) ||
+	     size < sizeof(trace_header) + header->capacity * sizeof(trace_record)) {
+	fprintf(stderr, "%s: not a goofy trace\n", path);
+	exit(1);
+    }
+}
+
+uint64_t trace_file::count() const {
+    uint64_t n = header->appended.load();
+    return n < header->capacity ? n : header->capacity;
+}
+
+const trace_record &trace_file::record(uint64_t k) const {
+    uint64_t n = header->appended.load();
+    uint64_t oldest = n < header->capacity ? 0 : n - header->capacity;
+    return records[(oldest + k) % header->capacity];
+}
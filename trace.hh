@@ -0,0 +1,86 @@
+#ifndef TRACE_HH_
+#define TRACE_HH_
+/*
+ * A binary trace of every request, for analysis after the run (see
+ * goofy-trace). Records are fixed-size and go into a ring in a shared
+ * file mapping; reactors claim slots with one atomic add and copy the
+ * record in, so tracing costs no formatting or system calls. Once the
+ * ring is full the oldest records are overwritten.
+ */
+#include <stdint.h>
+#include <atomic>
+
+#define TRACE_MAGIC "GOOFYTR2"
+
+// How a traced request ended. err holds an errno for the syscall
+// kinds, an http_error for TRACE_RESPONSE, an OpenSSL reason for
+// TRACE_TLS and the latency_phase that ran out of time for
+// TRACE_TIMEOUT.
+enum trace_kind {
+    TRACE_OK = 0, TRACE_SOCKET, TRACE_CONNECT, TRACE_WRITE, TRACE_READ,
+    TRACE_RESPONSE, TRACE_BIND, TRACE_TLS, TRACE_TIMEOUT, TRACE_KINDS
+};
+
+// trace_record flags. A connection's connect and handshake times are
+// copied into every request it carries; TRACE_FIRST marks the record
+// for its first request, the one those times should be counted for.
+enum { TRACE_FIRST = 0x01 };
+
+struct trace_record {
+    uint32_t request_number;
+    uint16_t url_number;
+    uint8_t reactor;
+    uint8_t kind;
+    // HTTP status, or 0 if none arrived.
+    uint16_t status;
+    uint8_t flags;
+    uint8_t unused;
+    int32_t err;
+    // From time_interval::usec(); 0 for steps never reached. A
+    // connection's first request was due at its wave's start.
+    int64_t scheduled;
+    int64_t connecting;
+    int64_t connected;
+    int64_t handshaken;
+    int64_t first_byte;
+    int64_t done;
+};
+
+struct trace_header {
+    char magic[8];
+    uint32_t record_size;
+    uint32_t unused;
+    // Records the ring holds, and how many were ever appended.
+    uint64_t capacity;
+    std::atomic<uint64_t> appended;
+    // When the test started, from time_interval::usec().
+    int64_t start;
+};
+
+class trace_file {
+public:
+    // Create path holding capacity records for writing, or map an
+    // existing trace for reading if capacity is 0. Exit on failure.
+    trace_file(const char *path, uint64_t capacity = 0);
+
+    // Add rec to the ring. Safe to call from any thread.
+    void append(const trace_record &rec) {
+	uint64_t n = header->appended.fetch_add(1, std::memory_order_relaxed);
+	records[n % header->capacity] = rec;
+    }
+
+    void set_start(int64_t start) { header->start = start; }
+    int64_t start() const { return header->start; }
+
+    // The records still in the ring, oldest first.
+    uint64_t count() const;
+    const trace_record &record(uint64_t k) const;
+
+private:
+    trace_header *header;
+    trace_record *records;
+};
+
+extern const char *trace_kind_names[TRACE_KINDS];
+
+#endif /* TRACE_HH_ */
@@ -0,0 +1,380 @@
+#include "uring.hh"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/socket.h>
+#include <sys/eventfd.h>
+
+// Receive buffers provided to the kernel for recv completions.
+#define URING_BUF_GROUP 1
+#define URING_BUF_COUNT 1024
+#define URING_BUF_SIZE  8192
+
+// user_data for operations that report nothing to the caller.
+#define URING_INTERNAL 0xff
+#define URING_WAKE     0xfe
+
+/*
+ * uring
+ */
+
+static int io_uring_setup(unsigned entries, struct io_uring_params *p) {
+    return syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int io_uring_enter(int fd, unsigned to_submit, unsigned min_complete,
+			  unsigned flags, void *arg, size_t argsz) {
+    return syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, arg, argsz);
+}
+
+static int io_uring_register(int fd, unsigned opcode, void *arg, unsigned nr_args) {
+    return syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+uring *uring::create(unsigned entries, unsigned cq_entries) {
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    p.flags = IORING_SETUP_CQSIZE;
+    p.cq_entries = cq_entries;
+    int fd = io_uring_setup(entries, &p);
+    if (fd < 0)
+	return NULL;
+
+    // Timed waits and never losing a completion are not optional.
+    if (!(p.features & IORING_FEAT_EXT_ARG) || !(p.features & IORING_FEAT_NODROP)) {
+	close(fd);
+	return NULL;
+    }
+
+    uring *r = new uring();
+    r->ring_fd = fd;
+    r->sq_local_tail = r->to_submit = 0;
+    r->sq_ring_sz = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    r->cq_ring_sz = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+	r->sq_ring_sz = r->cq_ring_sz = std::max(r->sq_ring_sz, r->cq_ring_sz);
+    }
+    r->sqes_sz = p.sq_entries * sizeof(struct io_uring_sqe);
+
+    r->sq_ring = mmap(NULL, r->sq_ring_sz, PROT_READ|PROT_WRITE,
+		      MAP_SHARED|MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    if (r->sq_ring == MAP_FAILED) {
+	perror("mmap(IORING_OFF_SQ_RING)");
+	exit(1);
+    }
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+	r->cq_ring = r->sq_ring;
+    }
+    else {
+	r->cq_ring = mmap(NULL, r->cq_ring_sz, PROT_READ|PROT_WRITE,
+			  MAP_SHARED|MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+	if (r->cq_ring == MAP_FAILED) {
+	    perror("mmap(IORING_OFF_CQ_RING)");
+	    exit(1);
+	}
+    }
+    r->sqes = (struct io_uring_sqe *)mmap(NULL, r->sqes_sz, PROT_READ|PROT_WRITE,
+					  MAP_SHARED|MAP_POPULATE, fd, IORING_OFF_SQES);
+    if (r->sqes == MAP_FAILED) {
+	perror("mmap(IORING_OFF_SQES)");
+	exit(1);
+    }
+
+    char *sq = (char *)r->sq_ring, *cq = (char *)r->cq_ring;
+    r->sq_head = (unsigned *)(sq + p.sq_off.head);
+    r->sq_tail = (unsigned *)(sq + p.sq_off.tail);
+    r->sq_mask = (unsigned *)(sq + p.sq_off.ring_mask);
+    r->sq_array = (unsigned *)(sq + p.sq_off.array);
+    r->cq_head = (unsigned *)(cq + p.cq_off.head);
+    r->cq_tail = (unsigned *)(cq + p.cq_off.tail);
+    r->cq_mask = (unsigned *)(cq + p.cq_off.ring_mask);
+    r->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+    r->sq_local_tail = *r->sq_tail;
+
+    // Learn which opcodes the kernel knows. Kernels without probing
+    // predate everything goofy needs.
+    size_t probe_sz = sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op);
+    struct io_uring_probe *probe = (struct io_uring_probe *)calloc(1, probe_sz);
+    if (io_uring_register(fd, IORING_REGISTER_PROBE, probe, 256) == 0) {
+	for (int i = 0; i < probe->ops_len; i++) {
+	    if (probe->ops[i].flags & IO_URING_OP_SUPPORTED) {
+		if (r->ops.size() <= probe->ops[i].op)
+		    r->ops.resize(probe->ops[i].op + 1, 0);
+		r->ops[probe->ops[i].op] = 1;
+	    }
+	}
+    }
+    free(probe);
+    return r;
+}
+
+uring::~uring() {
+    munmap(sqes, sqes_sz);
+    if (cq_ring != sq_ring)
+	munmap(cq_ring, cq_ring_sz);
+    munmap(sq_ring, sq_ring_sz);
+    close(ring_fd);
+}
+
+int uring::supports(int op) const {
+    return op < (int)ops.size() && ops[op];
+}
+
+struct io_uring_sqe *uring::get_sqe() {
+    unsigned head = __atomic_load_n(sq_head, __ATOMIC_ACQUIRE);
+    if (sq_local_tail - head > *sq_mask) {
+	if (enter(0) < 0) {
+	    perror("io_uring_enter");
+	    exit(1);
+	}
+    }
+    unsigned idx = sq_local_tail & *sq_mask;
+    struct io_uring_sqe *sqe = &sqes[idx];
+    memset(sqe, 0, sizeof(*sqe));
+    sq_array[idx] = idx;
+    sq_local_tail++;
+    to_submit++;
+    return sqe;
+}
+
+int uring::enter(int timeout) {
+    __atomic_store_n(sq_tail, sq_local_tail, __ATOMIC_RELEASE);
+
+    unsigned flags = 0, min_complete = 0;
+    struct io_uring_getevents_arg arg;
+    struct __kernel_timespec ts;
+    memset(&arg, 0, sizeof(arg));
+    if (timeout != 0) {
+	flags = IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG;
+	min_complete = 1;
+	if (timeout > 0) {
+	    ts.tv_sec = timeout / 1000;
+	    ts.tv_nsec = (timeout % 1000) * 1000000L;
+	    arg.ts = (unsigned long)&ts;
+	}
+    }
+    if (to_submit == 0 && min_complete == 0)
+	return 0;
+
+    enters++;
+    int n = io_uring_enter(ring_fd, to_submit, min_complete, flags, &arg, sizeof(arg));
+    if (n < 0) {
+	// A timeout is not an error; neither is a full completion queue,
+	// which the caller is about to drain.
+	if (errno == ETIME || errno == EBUSY || errno == EAGAIN)
+	    return 0;
+	return -1;
+    }
+    to_submit -= std::min((unsigned)n, to_submit);
+    return n;
+}
+
+struct io_uring_cqe *uring::peek() {
+    unsigned head = *cq_head;
+    if (head == __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE))
+	return NULL;
+    return &cqes[head & *cq_mask];
+}
+
+void uring::seen() {
+    __atomic_store_n(cq_head, *cq_head + 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * uring_engine
+ */
+
+static inline unsigned long long pack(int slot, unsigned gen, int op) {
+    return (unsigned long long)(unsigned)slot
+	| ((unsigned long long)(gen & 0xffffff) << 32)
+	| ((unsigned long long)op << 56);
+}
+
+uring_engine *uring_engine::create(int max_slots) {
+    uring *ring = uring::create(4096, 65536);
+    if (ring == NULL)
+	return NULL;
+    if (!ring->supports(IORING_OP_CONNECT) || !ring->supports(IORING_OP_SENDMSG) ||
+	!ring->supports(IORING_OP_RECV) || !ring->supports(IORING_OP_PROVIDE_BUFFERS) ||
+	!ring->supports(IORING_OP_READ)) {
+	delete ring;
+	return NULL;
+    }
+    return new uring_engine(ring, max_slots);
+}
+
+uring_engine::uring_engine(uring *_ring, int max_slots)
+    : ring(_ring), gen(max_slots, 0), inflight(max_slots, 0), fds(max_slots, -1),
+      sends(max_slots) {
+    bufs = (char *)malloc(URING_BUF_COUNT * URING_BUF_SIZE);
+    struct io_uring_sqe *sqe = ring->get_sqe();
+    sqe->opcode = IORING_OP_PROVIDE_BUFFERS;
+    sqe->fd = URING_BUF_COUNT;
+    sqe->addr = (unsigned long)bufs;
+    sqe->len = URING_BUF_SIZE;
+    sqe->off = 0;
+    sqe->buf_group = URING_BUF_GROUP;
+    sqe->user_data = pack(0, 0, URING_INTERNAL);
+
+    wakefd = eventfd(0, EFD_CLOEXEC);
+    if (wakefd < 0) {
+	perror("eventfd");
+	exit(1);
+    }
+    arm_wake();
+}
+
+uring_engine::~uring_engine() {
+    delete ring;
+    close(wakefd);
+    free(bufs);
+}
+
+void uring_engine::arm_wake() {
+    struct io_uring_sqe *sqe = ring->get_sqe();
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = wakefd;
+    sqe->addr = (unsigned long)&wake_count;
+    sqe->len = sizeof(wake_count);
+    sqe->user_data = pack(0, 0, URING_WAKE);
+}
+
+void uring_engine::wake() {
+    eventfd_write(wakefd, 1);
+}
+
+struct io_uring_sqe *uring_engine::prep(int slot, int op, int opcode, int fd) {
+    struct io_uring_sqe *sqe = ring->get_sqe();
+    sqe->opcode = opcode;
+    sqe->fd = fd;
+    sqe->user_data = pack(slot, gen[slot], op);
+    inflight[slot]++;
+    fds[slot] = fd;
+    return sqe;
+}
+
+void uring_engine::provide(int bid) {
+    struct io_uring_sqe *sqe = ring->get_sqe();
+    sqe->opcode = IORING_OP_PROVIDE_BUFFERS;
+    sqe->fd = 1;
+    sqe->addr = (unsigned long)(bufs + (size_t)bid * URING_BUF_SIZE);
+    sqe->len = URING_BUF_SIZE;
+    sqe->off = bid;
+    sqe->buf_group = URING_BUF_GROUP;
+    sqe->user_data = pack(0, 0, URING_INTERNAL);
+}
+
+void uring_engine::connect(int slot, int fd, const struct sockaddr *addr, socklen_t len) {
+    struct io_uring_sqe *sqe = prep(slot, EV_CONNECT, IORING_OP_CONNECT, fd);
+    sqe->addr = (unsigned long)addr;
+    sqe->off = len;
+}
+
+void uring_engine::write(int slot, int fd, const struct iovec *iov, int iovcnt) {
+    send_args &args = sends[slot];
+    memcpy(args.iov, iov, iovcnt * sizeof(*iov));
+    memset(&args.msg, 0, sizeof(args.msg));
+    args.msg.msg_iov = args.iov;
+    args.msg.msg_iovlen = iovcnt;
+
+    struct io_uring_sqe *sqe = prep(slot, EV_WRITE, IORING_OP_SENDMSG, fd);
+    sqe->addr = (unsigned long)&args.msg;
+    sqe->len = 1;
+    sqe->msg_flags = MSG_NOSIGNAL;
+}
+
+void uring_engine::read(int slot, int fd) {
+    struct io_uring_sqe *sqe = prep(slot, EV_READ, IORING_OP_RECV, fd);
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = URING_BUF_GROUP;
+    sqe->len = URING_BUF_SIZE;
+}
+
+void uring_engine::flush() {
+    if (ring->enter(0) < 0) {
+	perror("io_uring_enter");
+	exit(1);
+    }
+    syscalls += ring->enters;
+    ring->enters = 0;
+}
+
+void uring_engine::remove(int slot, int fd) {
+    // Operations still in flight would otherwise wait for a peer that
+    // may never speak again. Shutting the socket down completes them;
+    // the generation bump makes wait() drop their completions.
+    gen[slot]++;
+    if (inflight[slot] > 0) {
+	shutdown(fd, SHUT_RDWR);
+	syscalls++;
+    }
+}
+
+int uring_engine::wait(event_t *out, int max, int timeout) {
+    // The caller is done with buffers handed out last time.
+    for (size_t i = 0; i < lent.size(); i++)
+	provide(lent[i]);
+    lent.clear();
+    for (size_t i = 0; i < starved.size(); i++) {
+	int slot = starved[i].first;
+	if (starved[i].second == gen[slot])
+	    read(slot, fds[slot]);
+    }
+    starved.clear();
+
+    int r = ring->enter(ring->peek() ? 0 : timeout);
+    syscalls += ring->enters;
+    ring->enters = 0;
+    if (r < 0)
+	return -1;
+
+    int n = 0;
+    struct io_uring_cqe *cqe;
+    while (n < max && (cqe = ring->peek()) != NULL) {
+	unsigned long long data = cqe->user_data;
+	int res = cqe->res, flags = cqe->flags;
+	ring->seen();
+
+	int op = data >> 56;
+	if (op == URING_WAKE) {
+	    arm_wake();
+	    continue;
+	}
+	if (op == URING_INTERNAL) {
+	    if (res < 0) {
+		fprintf(stderr, "io_uring: provide buffers: %s\n", strerror(-res));
+		exit(1);
+	    }
+	    continue;
+	}
+
+	int slot = data & 0xffffffff;
+	unsigned g = (data >> 32) & 0xffffff;
+	char *buf = NULL;
+	inflight[slot]--;
+	if (flags & IORING_CQE_F_BUFFER) {
+	    int bid = flags >> IORING_CQE_BUFFER_SHIFT;
+	    buf = bufs + (size_t)bid * URING_BUF_SIZE;
+	    lent.push_back(bid);
+	}
+	if (g != (gen[slot] & 0xffffff))
+	    continue;
+	if (op == EV_READ && res == -ENOBUFS) {
+	    // Every buffer is in use; try again once they are returned.
+	    starved.push_back(std::make_pair(slot, gen[slot]));
+	    continue;
+	}
+
+	out[n].slot = slot;
+	out[n].op = (enum event_op)op;
+	out[n].revents = 0;
+	out[n].res = res;
+	out[n].buf = buf;
+	n++;
+    }
+    return n;
+}
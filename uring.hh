@@ -0,0 +1,109 @@
+#ifndef URING_HH_
+#define URING_HH_
+/*
+ * A minimal io_uring binding using the raw system calls, so goofy does
+ * not depend on liburing.
+ */
+#include <linux/io_uring.h>
+#include <vector>
+#include "event.hh"
+
+// The most iovecs uring_engine::write() accepts.
+#define URING_IOV_MAX 8
+
+class uring {
+public:
+    // Return NULL if the kernel lacks io_uring or a feature goofy needs.
+    static uring *create(unsigned entries, unsigned cq_entries);
+    ~uring();
+
+    // Return a zeroed SQE, submitting queued ones first if the
+    // submission queue is full.
+    struct io_uring_sqe *get_sqe();
+
+    // Submit queued SQEs and wait up to timeout ms (-1 forever, 0 not
+    // at all) for at least one completion. Return -1 with errno set on
+    // failure.
+    int enter(int timeout);
+
+    // Return the next completion, or NULL. Call seen() when done with it.
+    struct io_uring_cqe *peek();
+    void seen();
+
+    // TRUE if the kernel supports opcode op.
+    int supports(int op) const;
+
+    // io_uring_enter() calls made; the owner may reset it.
+    long long enters;
+
+private:
+    uring() : enters(0) {}
+
+    int ring_fd;
+    unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    unsigned sq_local_tail, to_submit;
+    void *sq_ring, *cq_ring;
+    size_t sq_ring_sz, cq_ring_sz, sqes_sz;
+    std::vector<unsigned char> ops;
+};
+
+/*
+ * io_uring execution. Rather than reporting readiness, the engine
+ * performs connect(), send() and recv() itself and reports their
+ * completions. Operations queued while handling one batch of
+ * completions, or while opening a wave, reach the kernel together in
+ * one io_uring_enter().
+ */
+class uring_engine : public event_engine {
+public:
+    // Return NULL if io_uring is not available.
+    static uring_engine *create(int max_slots);
+    ~uring_engine();
+
+    const char *name() const { return "uring"; }
+    int edge_triggered() const { return 1; }
+    int completions() const { return 1; }
+    void add(int slot, int fd, int events) {}
+    void modify(int slot, int fd, int events) {}
+    void remove(int slot, int fd);
+    int wait(event_t *out, int max, int timeout);
+    void wake();
+
+    void connect(int slot, int fd, const struct sockaddr *addr, socklen_t len);
+    void write(int slot, int fd, const struct iovec *iov, int iovcnt);
+    void read(int slot, int fd);
+    void flush();
+
+private:
+    uring_engine(uring *_ring, int max_slots);
+    struct io_uring_sqe *prep(int slot, int op, int opcode, int fd);
+    void provide(int bid);
+    void arm_wake();
+
+    uring *ring;
+    // wake() writes to wakefd, completing a read that is always queued.
+    int wakefd;
+    unsigned long long wake_count;
+    // Bumped when a slot is released, so completions still in flight
+    // for its previous connection are recognized and dropped.
+    std::vector<unsigned> gen;
+    std::vector<int> inflight, fds;
+    // The kernel reads a send's msghdr and iovecs asynchronously, so
+    // they live here rather than on the caller's stack.
+    struct send_args {
+	struct msghdr msg;
+	struct iovec iov[URING_IOV_MAX];
+    };
+    std::vector<send_args> sends;
+    // Provided receive buffers, and those lent out by the last wait().
+    char *bufs;
+    std::vector<int> lent;
+    // Slots (and their generation) whose recv found no free buffer, to
+    // retry on the next wait().
+    std::vector<std::pair<int,unsigned> > starved;
+};
+
+#endif /* URING_HH_ */
@@ -28,15 +28,21 @@ void url::parse(const string& url_s)
     advance(it, prot_end.length());
 
     // [user[:pass]@]host[:port]. user:pass is not yet supported.
+    int default_port = (protocol_ == "https" ? 443 : 80);
     string::const_iterator path_i = find(it, url_s.end(), '/');
     host_.reserve(distance(it, path_i));
     host_.assign(it, path_i);
-    if ((i=host_.find(':')) != host_.npos) {
+    // An IPv6 literal is bracketed, since it contains colons itself.
+    if (host_.size() > 0 && host_[0] == '[' && (i=host_.find(']')) != host_.npos) {
+	port_ = (i+1 < host_.size() && host_[i+1] == ':') ? atoi(host_.c_str()+i+2) : default_port;
+	host_ = host_.substr(1, i-1);
+    }
+    else if ((i=host_.find(':')) != host_.npos) {
 	port_ = atoi(host_.substr(i+1, host_.npos).c_str());
 	host_.resize(i);
     }
     else {
-	port_ = 80;
+	port_ = default_port;
     }
     // host is icase
     transform(host_.begin(), host_.end(), host_.begin(), ptr_fun<int,int>(tolower));
@@ -4,6 +4,7 @@
 struct url {
     url(const std::string& url_s);
     const std::string& full() { return url_; }
+    const std::string& protocol() { return protocol_; }
     const std::string& host() { return host_; }
     const std::string& request() { return request_; }
     int port() { return port_; }